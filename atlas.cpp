@@ -0,0 +1,138 @@
+#include "atlas.h"
+
+#include <QPainter>
+#include <QString>
+
+#include <string.h>
+
+// makes the color of the top left pixel transparent
+static QImage toAlpha(const QImage &image)
+{
+    if (image.isNull())
+        return image;
+    QRgb alpha = image.pixel(0, 0);
+    QImage result = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QRgb *data = reinterpret_cast<QRgb *>(result.bits());
+    int size = image.width() * image.height();
+    for (int i = 0; i < size; ++i)
+        if (data[i] == alpha)
+            data[i] = 0;
+    return result;
+}
+
+// pixels of border around each image
+static const int border = 1;
+
+// copies the edge pixels of rect in image out into its border, both
+// formats an atlas is made in have 32 bits per pixel
+static void extendEdges(QImage *image, const QRect &rect)
+{
+    if (rect.isEmpty())
+        return;
+
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image->scanLine(y));
+        for (int i = 1; i <= border; ++i) {
+            line[rect.left() - i] = line[rect.left()];
+            line[rect.right() + i] = line[rect.right()];
+        }
+    }
+
+    // the rows take the corners along
+    const int x = rect.left() - border;
+    const int bytes = (rect.width() + 2 * border) * sizeof(QRgb);
+    for (int i = 1; i <= border; ++i) {
+        memcpy(image->scanLine(rect.top() - i) + x * sizeof(QRgb), image->scanLine(rect.top()) + x * sizeof(QRgb), bytes);
+        memcpy(image->scanLine(rect.bottom() + i) + x * sizeof(QRgb), image->scanLine(rect.bottom()) + x * sizeof(QRgb), bytes);
+    }
+}
+
+Atlas::Atlas(QImage::Format format)
+    : m_format(format)
+{
+}
+
+int Atlas::add(const QImage &image)
+{
+    m_pending << image;
+    m_rects << QRect();
+    return m_rects.size() - 1;
+}
+
+void Atlas::pack(int maxWidth)
+{
+    int width = 0;
+    int rowWidth = 0;
+    foreach (const QImage &image, m_pending) {
+        rowWidth += image.width() + 2 * border;
+        width = qMax(width, qMin(rowWidth, maxWidth));
+        width = qMax(width, image.width() + 2 * border);
+    }
+
+    // place the images in rows, a row is as high as its highest image
+    QVector<QPoint> positions;
+    int x = 0;
+    int y = 0;
+    int rowHeight = 0;
+    foreach (const QImage &image, m_pending) {
+        const int w = image.width() + 2 * border;
+        const int h = image.height() + 2 * border;
+        if (x > 0 && x + w > width) {
+            x = 0;
+            y += rowHeight;
+            rowHeight = 0;
+        }
+        positions << QPoint(x, y);
+        x += w;
+        rowHeight = qMax(rowHeight, h);
+    }
+
+    m_image = QImage(width, y + rowHeight, m_format);
+    m_image.fill(0);
+
+    QPainter painter(&m_image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (int i = 0; i < m_pending.size(); ++i) {
+        const QImage &image = m_pending.at(i);
+        m_rects[i] = QRect(positions.at(i) + QPoint(border, border), image.size());
+        painter.drawImage(m_rects.at(i).topLeft(), image);
+    }
+    painter.end();
+
+    foreach (const QRect &rect, m_rects)
+        extendEdges(&m_image, rect);
+
+    m_pending.clear();
+}
+
+QRectF Atlas::textureRect(int index) const
+{
+    const QRect rect = m_rects.at(index);
+    const qreal width = m_image.width();
+    const qreal height = m_image.height();
+    return QRectF(rect.x() / width, 1 - (rect.y() + rect.height()) / height,
+                  rect.width() / width, rect.height() / height);
+}
+
+const AssetPack &AssetPack::instance()
+{
+    static AssetPack pack;
+    return pack;
+}
+
+AssetPack::AssetPack()
+    : m_walls(QImage::Format_RGB32)
+    , m_soldier(QImage::Format_ARGB32_Premultiplied)
+{
+    // in the order of WallImage
+    m_walls.add(QImage("brown.png").convertToFormat(QImage::Format_RGB32));
+    m_walls.add(QImage("book.png").convertToFormat(QImage::Format_RGB32));
+    m_walls.add(QImage("door.png").convertToFormat(QImage::Format_RGB32));
+    m_walls.pack();
+
+    for (int i = 1; i <= 40; ++i) {
+        QImage image(QString("character/O%0.png").arg(i, 2, 10, QLatin1Char('0')));
+        m_soldier.add(toAlpha(image.convertToFormat(QImage::Format_RGB32)));
+    }
+    m_soldier.pack();
+}
@@ -0,0 +1,65 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <QImage>
+#include <QRect>
+#include <QRectF>
+#include <QVector>
+
+// Many small images packed into one, so that drawing any of them draws
+// from the same image and, with OpenGL, the same texture. The images are
+// placed left to right in rows in the order they were added, each with a
+// border of its own edge pixels so that filtering at its edges does not
+// pick up the neighbours.
+class Atlas
+{
+public:
+    explicit Atlas(QImage::Format format = QImage::Format_ARGB32_Premultiplied);
+
+    // returns the index of the image, which is only placed by pack()
+    int add(const QImage &image);
+    void pack(int maxWidth = 1024);
+
+    const QImage &image() const { return m_image; }
+    int count() const { return m_rects.size(); }
+
+    // where image index is in image(), in pixels
+    QRect rect(int index) const { return m_rects.at(index); }
+
+    // the same in texture coordinates, from the bottom left like an image
+    // bound with QGLContext::InvertedYBindOption
+    QRectF textureRect(int index) const;
+
+private:
+    QImage::Format m_format;
+    QVector<QImage> m_pending;
+    QVector<QRect> m_rects;
+    QImage m_image;
+};
+
+// The images every scene draws, decoded once and packed into atlases.
+class AssetPack
+{
+public:
+    static const AssetPack &instance();
+
+    enum WallImage
+    {
+        BrownWall,
+        BookWall,
+        DoorWall
+    };
+
+    const Atlas &walls() const { return m_walls; }
+
+    // the frames of character/O01.png to O40.png, in that order
+    const Atlas &soldier() const { return m_soldier; }
+
+private:
+    AssetPack();
+
+    Atlas m_walls;
+    Atlas m_soldier;
+};
+
+#endif
@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = collision
+
+include(../shared/shared.pri)
+
+SOURCES += main.cpp
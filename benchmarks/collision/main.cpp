@@ -0,0 +1,138 @@
+// Times the collision queries of MazeScene on generated mazes with a
+// growing number of walking entities, with the doors closed and open. No
+// window is shown, so it runs without a display or a GPU.
+//
+// usage: collision [--sizes 24x10,64x64,...] [--entities 0,16,256]
+//                  [--doors closed,open] [--queries 200000] [--ticks 200] [--seed 1]
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include <qmath.h>
+
+#include "benchmark.h"
+#include "entity.h"
+#include "mazegenerator.h"
+
+// walking step of a query, a bit more than an entity walks in 20 ms
+static const qreal queryStep = 0.05;
+
+static QVector<QPoint> openCells(const MazeGenerator &generator)
+{
+    QVector<QPoint> cells;
+    for (int y = 0; y < generator.height(); ++y) {
+        for (int x = 0; x < generator.width(); ++x) {
+            if (generator.map()[y * generator.width() + x] == ' ')
+                cells << QPoint(x, y);
+        }
+    }
+    return cells;
+}
+
+static qreal randomUnit()
+{
+    return qrand() / (RAND_MAX + qreal(1));
+}
+
+// a scene with count entities in distinct open cells, most of them walking
+static MazeScene *createScene(const MazeGenerator &generator, QVector<QPoint> cells, int count)
+{
+    MazeScene *scene = new MazeScene(generator.lights(), generator.map(),
+                                     generator.width(), generator.height());
+
+    for (int i = 0; i < count && i < cells.size(); ++i) {
+        qSwap(cells[i], cells[i + qrand() % (cells.size() - i)]);
+
+        Entity *entity = new Entity(QPointF(cells.at(i)) + QPointF(0.5, 0.5));
+        entity->turnTowards(qrand() % generator.width(), qrand() % generator.height());
+        if (i % 4 != 0)
+            entity->walk();
+        if (i % 4 == 1)
+            entity->turnLeft();
+        scene->addEntity(entity);
+    }
+
+    return scene;
+}
+
+int main(int argc, char **argv)
+{
+    // no GUI needed, the generated maps never create widgets
+    QApplication app(argc, argv, false);
+
+    const QStringList arguments = app.arguments();
+    const int queries = argumentValue(arguments, "--queries", "200000").toInt();
+    const int ticks = argumentValue(arguments, "--ticks", "200").toInt();
+    const uint seed = argumentValue(arguments, "--seed", "1").toUInt();
+    const QList<QSize> sizes = parseSizes(argumentValue(arguments, "--sizes", "24x10,64x64,256x256"));
+    const QStringList entityCounts = argumentValue(arguments, "--entities", "0,16,256").split(',');
+    const QStringList doorStates = argumentValue(arguments, "--doors", "closed,open").split(',');
+
+    QTextStream out(stdout);
+
+    foreach (const QSize &size, sizes) {
+        const MazeGenerator generator(size.width(), size.height(), seed);
+        const QVector<QPoint> cells = openCells(generator);
+        if (cells.isEmpty())
+            continue;
+
+        foreach (const QString &entityCount, entityCounts) {
+            foreach (const QString &doors, doorStates) {
+                qsrand(seed);
+
+                // a fresh scene each time, moveEntities() below walks the entities
+                MazeScene *scene = createScene(generator, cells, entityCount.toInt());
+                scene->setDoorsOpen(doors == "open");
+
+                QVector<QPointF> positions(queries);
+                QVector<QPointF> deltas(queries);
+                for (int i = 0; i < queries; ++i) {
+                    const QPoint cell = cells.at(qrand() % cells.size());
+                    positions[i] = QPointF(cell.x() + 0.2 + 0.6 * randomUnit(),
+                                           cell.y() + 0.2 + 0.6 * randomUnit());
+                    deltas[i] = QLineF::fromPolar(queryStep, 360 * randomUnit()).p2();
+                }
+
+                QElapsedTimer timer;
+
+                int blockedCount = 0;
+                timer.start();
+                for (int i = 0; i < queries; ++i)
+                    blockedCount += scene->blocked(positions.at(i), 0);
+                const qint64 blockedTime = timer.nsecsElapsed();
+
+                int movedCount = 0;
+                timer.start();
+                for (int i = 0; i < queries; ++i) {
+                    QPointF pos = positions.at(i);
+                    movedCount += scene->tryMove(pos, deltas.at(i));
+                }
+                const qint64 tryMoveTime = timer.nsecsElapsed();
+
+                // the simulation steps, all entities at once through
+                // tryMoveAll() and the collision grid kept up to date
+                const QVector<Entity *> entities = scene->entities();
+                qint64 moveEntitiesTime = 0;
+                for (int tick = 0; tick < ticks && !entities.isEmpty(); ++tick) {
+                    timer.start();
+                    scene->moveEntities(20);
+                    moveEntitiesTime += timer.nsecsElapsed();
+                }
+
+                out << size.width() << 'x' << size.height() << ": " << scene->wallCount() << " walls, "
+                    << entities.size() << " entities, doors " << doors << endl;
+                out << "  blocked       " << throughput(blockedTime, queries)
+                    << "  (" << 100 * blockedCount / qMax(1, queries) << "% blocked)" << endl;
+                out << "  tryMove       " << throughput(tryMoveTime, queries)
+                    << "  (" << 100 * movedCount / qMax(1, queries) << "% moved)" << endl;
+                if (!entities.isEmpty())
+                    out << "  moveEntities  " << throughput(moveEntitiesTime, qint64(ticks) * entities.size()) << endl;
+
+                delete scene;
+            }
+        }
+    }
+
+    return 0;
+}
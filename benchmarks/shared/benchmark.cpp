@@ -0,0 +1,83 @@
+#include "benchmark.h"
+
+#include <qalgorithms.h>
+
+Samples::Samples()
+    : m_sorted(true)
+{
+}
+
+void Samples::add(qint64 nsecs)
+{
+    m_samples << nsecs;
+    m_sorted = false;
+}
+
+qreal Samples::percentile(qreal p) const
+{
+    if (m_samples.isEmpty())
+        return 0;
+
+    if (!m_sorted) {
+        qSort(m_samples);
+        m_sorted = true;
+    }
+
+    const int index = qBound(0, int(p * m_samples.size()), m_samples.size() - 1);
+    return m_samples.at(index) * 1e-6;
+}
+
+qreal Samples::mean() const
+{
+    if (m_samples.isEmpty())
+        return 0;
+
+    qreal sum = 0;
+    foreach (qint64 sample, m_samples)
+        sum += sample;
+    return sum / m_samples.size() * 1e-6;
+}
+
+QString Samples::summary() const
+{
+    return QString("mean %1  p50 %2  p90 %3  p99 %4  max %5 ms")
+        .arg(mean(), 0, 'f', 3)
+        .arg(percentile(0.5), 0, 'f', 3)
+        .arg(percentile(0.9), 0, 'f', 3)
+        .arg(percentile(0.99), 0, 'f', 3)
+        .arg(percentile(1), 0, 'f', 3);
+}
+
+QString throughput(qint64 nsecs, qint64 count)
+{
+    if (count <= 0 || nsecs <= 0)
+        return QString("no queries");
+
+    return QString("%1 ns/query  %2 queries/s")
+        .arg(qreal(nsecs) / count, 0, 'f', 1)
+        .arg(qRound64(count * 1e9 / nsecs));
+}
+
+QString argumentValue(const QStringList &arguments, const QString &name, const QString &defaultValue)
+{
+    const int index = arguments.indexOf(name);
+    if (index < 0 || index + 1 >= arguments.size())
+        return defaultValue;
+    return arguments.at(index + 1);
+}
+
+QList<QSize> parseSizes(const QString &sizes)
+{
+    QList<QSize> result;
+    foreach (const QString &size, sizes.split(',', QString::SkipEmptyParts)) {
+        const QStringList parts = size.split('x');
+        if (parts.size() != 2)
+            continue;
+
+        const int width = parts.at(0).toInt();
+        const int height = parts.at(1).toInt();
+        if (width >= 5 && height >= 5)
+            result << QSize(width, height);
+    }
+    return result;
+}
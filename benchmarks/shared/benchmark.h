@@ -0,0 +1,40 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QList>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Timings of one stage over many frames.
+class Samples
+{
+public:
+    Samples();
+
+    void add(qint64 nsecs);
+    int count() const { return m_samples.size(); }
+
+    // in milliseconds, p between 0 and 1
+    qreal percentile(qreal p) const;
+    qreal mean() const;
+
+    // mean, median, 90th and 99th percentile and maximum on one line
+    QString summary() const;
+
+private:
+    mutable QVector<qint64> m_samples;
+    mutable bool m_sorted;
+};
+
+// time per query and queries per second for count queries taking nsecs
+QString throughput(qint64 nsecs, qint64 count);
+
+// value following name in arguments, e.g. "--frames 500"
+QString argumentValue(const QStringList &arguments, const QString &name, const QString &defaultValue);
+
+// map sizes from a comma separated list like "24x10,64x64"
+QList<QSize> parseSizes(const QString &sizes);
+
+#endif
@@ -0,0 +1,141 @@
+#include "mazegenerator.h"
+
+#include <QPoint>
+
+MazeGenerator::MazeGenerator(int width, int height, uint seed)
+    : m_width(width)
+    , m_height(height)
+    , m_state(seed)
+    , m_map(width * height, '#')
+{
+    carveMaze();
+    carveRooms();
+    addLoops();
+    decorate();
+    placeLights();
+}
+
+// a plain linear congruential generator, qrand() differs between platforms
+uint MazeGenerator::random(uint range)
+{
+    m_state = m_state * 1103515245 + 12345;
+    return ((m_state >> 16) & 0x7fff) * range / 0x8000;
+}
+
+// depth first maze on the cells with odd coordinates, the deepest stack
+// seen while carving becomes the camera path
+void MazeGenerator::carveMaze()
+{
+    const int dx[] = { 2, -2, 0, 0 };
+    const int dy[] = { 0, 0, 2, -2 };
+
+    QVector<QPoint> stack;
+    QVector<QPoint> deepest;
+
+    stack << QPoint(1, 1);
+    at(1, 1) = ' ';
+
+    while (!stack.isEmpty()) {
+        const QPoint cell = stack.last();
+
+        int directions[4];
+        int count = 0;
+        for (int i = 0; i < 4; ++i) {
+            const int x = cell.x() + dx[i];
+            const int y = cell.y() + dy[i];
+            if (x > 0 && y > 0 && x < m_width - 1 && y < m_height - 1 && at(x, y) == '#')
+                directions[count++] = i;
+        }
+
+        if (!count) {
+            if (stack.size() > deepest.size())
+                deepest = stack;
+            stack.pop_back();
+            continue;
+        }
+
+        const int i = directions[random(count)];
+        at(cell.x() + dx[i] / 2, cell.y() + dy[i] / 2) = ' ';
+        at(cell.x() + dx[i], cell.y() + dy[i]) = ' ';
+        stack << QPoint(cell.x() + dx[i], cell.y() + dy[i]);
+    }
+
+    for (int i = 0; i < deepest.size(); ++i) {
+        if (i > 0)
+            m_path << QPointF(deepest.at(i - 1) + deepest.at(i)) / 2 + QPointF(0.5, 0.5);
+        m_path << QPointF(deepest.at(i)) + QPointF(0.5, 0.5);
+    }
+}
+
+// open areas, so that some views look far across the map
+void MazeGenerator::carveRooms()
+{
+    const int rooms = m_width * m_height / 400;
+    for (int i = 0; i < rooms; ++i) {
+        const int w = 3 + 2 * random(4);
+        const int h = 3 + 2 * random(4);
+        if (w + 2 >= m_width || h + 2 >= m_height)
+            continue;
+
+        const int x = 1 + 2 * random((m_width - w - 1) / 2);
+        const int y = 1 + 2 * random((m_height - h - 1) / 2);
+        for (int j = y; j < y + h; ++j) {
+            for (int k = x; k < x + w; ++k)
+                at(k, j) = ' ';
+        }
+    }
+}
+
+// removes some of the walls between neighbouring corridors
+void MazeGenerator::addLoops()
+{
+    for (int y = 1; y < m_height - 1; ++y) {
+        for (int x = 1; x < m_width - 1; ++x) {
+            if (at(x, y) != '#' || random(8))
+                continue;
+
+            const bool horizontal = at(x - 1, y) == ' ' && at(x + 1, y) == ' ';
+            const bool vertical = at(x, y - 1) == ' ' && at(x, y + 1) == ' ';
+            if (horizontal != vertical)
+                at(x, y) = ' ';
+        }
+    }
+}
+
+void MazeGenerator::decorate()
+{
+    // doors only in narrow passages
+    for (int y = 1; y < m_height - 1; ++y) {
+        for (int x = 1; x < m_width - 1; ++x) {
+            if (at(x, y) != ' ' || random(16))
+                continue;
+
+            const bool horizontal = at(x - 1, y) == ' ' && at(x + 1, y) == ' '
+                && at(x, y - 1) == '#' && at(x, y + 1) == '#';
+            const bool vertical = at(x, y - 1) == ' ' && at(x, y + 1) == ' '
+                && at(x - 1, y) == '#' && at(x + 1, y) == '#';
+            if (horizontal || vertical)
+                at(x, y) = '-';
+        }
+    }
+
+    for (int y = 1; y < m_height - 1; ++y) {
+        for (int x = 1; x < m_width - 1; ++x) {
+            if (at(x, y) != '#')
+                continue;
+
+            const uint r = random(32);
+            if (r < 4)
+                at(x, y) = '&';
+            else if (r == 4)
+                at(x, y) = '@';
+        }
+    }
+}
+
+void MazeGenerator::placeLights()
+{
+    const int count = qMin(32, 4 + m_width * m_height / 1000);
+    for (int i = 0; i < m_path.size() && m_lights.size() < count; i += qMax(1, m_path.size() / count))
+        m_lights << Light(m_path.at(i), i % 3 ? 0.3 : 1);
+}
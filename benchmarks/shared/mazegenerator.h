@@ -0,0 +1,47 @@
+#ifndef MAZEGENERATOR_H
+#define MAZEGENERATOR_H
+
+#include <QByteArray>
+#include <QPointF>
+#include <QVector>
+
+#include "mazescene.h"
+
+// Builds maps for MazeScene out of a random maze with some rooms and
+// loops carved into it. The same seed always gives the same map. Only
+// plain walls, book shelves, doors and translucent walls are used, so
+// that no widgets have to be created.
+class MazeGenerator
+{
+public:
+    MazeGenerator(int width, int height, uint seed = 1);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    const char *map() const { return m_map.constData(); }
+
+    QVector<Light> lights() const { return m_lights; }
+
+    // cell centers along a long corridor through the maze
+    QVector<QPointF> path() const { return m_path; }
+
+private:
+    uint random(uint range);
+    char &at(int x, int y) { return m_map[y * m_width + x]; }
+
+    void carveMaze();
+    void carveRooms();
+    void addLoops();
+    void decorate();
+    void placeLights();
+
+    int m_width;
+    int m_height;
+    uint m_state;
+
+    QByteArray m_map;
+    QVector<QPointF> m_path;
+    QVector<Light> m_lights;
+};
+
+#endif
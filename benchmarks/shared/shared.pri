@@ -0,0 +1,25 @@
+# Engine sources shared by the benchmarks, everything from the main
+# project except its main.cpp
+
+ENGINE = $$PWD/../..
+
+DEPENDPATH += $$ENGINE $$PWD
+INCLUDEPATH += $$ENGINE $$PWD
+
+QT += webkit script opengl
+LIBS += -lGLEW
+
+CONFIG += console
+CONFIG -= app_bundle
+
+HEADERS += $$ENGINE/entity.h $$ENGINE/mazescene.h $$ENGINE/scriptwidget.h $$ENGINE/spanbuffer.h \
+           $$ENGINE/bsptree.h $$ENGINE/pvs.h $$ENGINE/segmentstore.h $$ENGINE/collisiongrid.h $$ENGINE/rectstore.h \
+           $$ENGINE/lockfree.h $$ENGINE/simulation.h $$ENGINE/framescheduler.h $$ENGINE/inputrecording.h $$ENGINE/worldrenderer.h $$ENGINE/atlas.h $$ENGINE/floorcaster.h $$ENGINE/lightmapbaker.h $$ENGINE/raycaster.h $$ENGINE/tilerasterizer.h \
+           $$ENGINE/modelitem.h $$ENGINE/model.h
+SOURCES += $$ENGINE/entity.cpp $$ENGINE/mazescene.cpp $$ENGINE/scriptwidget.cpp $$ENGINE/spanbuffer.cpp \
+           $$ENGINE/bsptree.cpp $$ENGINE/pvs.cpp $$ENGINE/segmentstore.cpp $$ENGINE/collisiongrid.cpp $$ENGINE/rectstore.cpp $$ENGINE/simulation.cpp \
+           $$ENGINE/framescheduler.cpp $$ENGINE/inputrecording.cpp $$ENGINE/worldrenderer.cpp $$ENGINE/atlas.cpp $$ENGINE/floorcaster.cpp $$ENGINE/lightmapbaker.cpp $$ENGINE/raycaster.cpp $$ENGINE/tilerasterizer.cpp \
+           $$ENGINE/model.cpp $$ENGINE/modelitem.cpp
+
+HEADERS += $$PWD/mazegenerator.h $$PWD/benchmark.h
+SOURCES += $$PWD/mazegenerator.cpp $$PWD/benchmark.cpp
@@ -0,0 +1,107 @@
+// Times the per frame work of MazeScene for a camera walking through
+// generated mazes of increasing size. No window is shown, so it runs
+// without a display or a GPU.
+//
+// usage: visibility [--frames 600] [--sizes 24x10,64x64,...] [--seed 1]
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include <qmath.h>
+
+#include "benchmark.h"
+#include "mazegenerator.h"
+
+// walking speed of the scene's camera, in cells per 20 ms frame
+static const qreal walkingSpeed = 0.04;
+
+// camera at the given distance along the path, path runs back and forth
+static Camera cameraAt(const QVector<QPointF> &path, qreal distance, int frame)
+{
+    const int segments = path.size() - 1;
+    qreal t = distance;
+    const qreal period = 2 * segments;
+    t -= qFloor(t / period) * period;
+
+    bool backwards = t > segments;
+    if (backwards)
+        t = period - t;
+
+    const int index = qMin(int(t), segments - 1);
+    const qreal f = t - index;
+
+    QPointF a = path.at(index);
+    QPointF b = path.at(index + 1);
+    if (backwards)
+        qSwap(a, b);
+
+    const QPointF pos = backwards ? b + (a - b) * f : a + (b - a) * f;
+    const QPointF direction = b - a;
+
+    Camera camera;
+    camera.setPos(pos);
+    // look around a bit while walking, yaw 0 looks along positive y
+    camera.setYaw(qAtan2(direction.x(), direction.y()) * 180 / M_PI + 30 * qSin(frame * 0.05));
+    camera.setPitch(5 * qSin(frame * 0.03));
+    camera.setTime(frame * 0.02);
+    return camera;
+}
+
+int main(int argc, char **argv)
+{
+    // no GUI needed, the generated maps never create widgets
+    QApplication app(argc, argv, false);
+
+    const QStringList arguments = app.arguments();
+    const int frames = argumentValue(arguments, "--frames", "600").toInt();
+    const uint seed = argumentValue(arguments, "--seed", "1").toUInt();
+    const QList<QSize> sizes =
+        parseSizes(argumentValue(arguments, "--sizes", "24x10,64x64,128x128,256x256,512x512,1000x1000"));
+
+    QTextStream out(stdout);
+
+    foreach (const QSize &size, sizes) {
+        const MazeGenerator generator(size.width(), size.height(), seed);
+        const QVector<QPointF> path = generator.path();
+        if (path.size() < 2)
+            continue;
+
+        QElapsedTimer timer;
+        timer.start();
+        MazeScene scene(generator.lights(), generator.map(), size.width(), size.height());
+        const qint64 buildTime = timer.elapsed();
+
+        Samples visibility;
+        Samples transform;
+        Samples lighting;
+        qint64 visibleItems = 0;
+
+        for (int frame = 0; frame < frames; ++frame) {
+            scene.setCamera(cameraAt(path, frame * walkingSpeed, frame));
+
+            timer.start();
+            scene.updateVisibility();
+            visibility.add(timer.nsecsElapsed());
+
+            timer.start();
+            scene.updateItemTransforms();
+            transform.add(timer.nsecsElapsed());
+
+            timer.start();
+            scene.updateLighting();
+            lighting.add(timer.nsecsElapsed());
+
+            visibleItems += scene.visibleItems().size();
+        }
+
+        out << size.width() << 'x' << size.height()
+            << ": " << scene.wallCount() << " walls, built in " << buildTime << " ms, "
+            << qreal(visibleItems) / qMax(1, frames) << " visible items per frame" << endl;
+        out << "  visibility  " << visibility.summary() << endl;
+        out << "  transform   " << transform.summary() << endl;
+        out << "  lighting    " << lighting.summary() << endl;
+    }
+
+    return 0;
+}
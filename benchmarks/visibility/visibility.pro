@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = visibility
+
+include(../shared/shared.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,377 @@
+#include "bsptree.h"
+
+#include <qalgorithms.h>
+
+static const int maxLeafSize = 4;
+static const int maxDepth = 48;
+static const qreal epsilon = 1e-6;
+
+static inline qreal coordinate(const QPointF &p, int axis)
+{
+    return axis == 0 ? p.x() : p.y();
+}
+
+static QRectF segmentBounds(const QVector<BspTree::Segment> &segments)
+{
+    qreal left = segments.at(0).a.x();
+    qreal right = left;
+    qreal top = segments.at(0).a.y();
+    qreal bottom = top;
+
+    foreach (const BspTree::Segment &segment, segments) {
+        left = qMin(left, qMin(segment.a.x(), segment.b.x()));
+        right = qMax(right, qMax(segment.a.x(), segment.b.x()));
+        top = qMin(top, qMin(segment.a.y(), segment.b.y()));
+        bottom = qMax(bottom, qMax(segment.a.y(), segment.b.y()));
+    }
+
+    return QRectF(left, top, right - left, bottom - top);
+}
+
+// -1 below the splitting line, 1 above, 0 on it and 2 when crossing it
+static inline int classify(const BspTree::Segment &segment, int axis, qreal value)
+{
+    const qreal da = coordinate(segment.a, axis) - value;
+    const qreal db = coordinate(segment.b, axis) - value;
+
+    const bool aOn = qAbs(da) < epsilon;
+    const bool bOn = qAbs(db) < epsilon;
+
+    if (aOn && bOn)
+        return 0;
+    if ((da < 0 || aOn) && (db < 0 || bOn))
+        return -1;
+    if ((da > 0 || aOn) && (db > 0 || bOn))
+        return 1;
+    return 2;
+}
+
+// positive if p is left of the line through the segment, seen from a to b
+static inline qreal side(const BspTree::Segment &segment, const QPointF &p)
+{
+    const QPointF d = segment.b - segment.a;
+    const QPointF e = p - segment.a;
+    return d.x() * e.y() - d.y() * e.x();
+}
+
+static inline qreal cross(const QPointF &u, const QPointF &v)
+{
+    return u.x() * v.y() - u.y() * v.x();
+}
+
+// whether some ray from pos passes through both segments
+static bool overlap(const BspTree::Segment &s, const BspTree::Segment &t, const QPointF &pos)
+{
+    QPointF sa = s.a - pos;
+    QPointF sb = s.b - pos;
+    if (cross(sa, sb) < 0)
+        qSwap(sa, sb);
+
+    QPointF ta = t.a - pos;
+    QPointF tb = t.b - pos;
+    if (cross(ta, tb) < 0)
+        qSwap(ta, tb);
+
+    // one of them starts inside the other, which goes on past that
+    return (cross(sa, ta) >= 0 && cross(ta, sb) > epsilon)
+        || (cross(ta, sa) >= 0 && cross(sa, tb) > epsilon);
+}
+
+// whether s hides part of t from pos, segments that do not cross are in
+// front of each other where they overlap either way
+static bool hides(const BspTree::Segment &s, const BspTree::Segment &t, const QPointF &pos)
+{
+    if (!overlap(s, t, pos))
+        return false;
+
+    const qreal sa = side(s, pos) * side(s, t.a);
+    const qreal sb = side(s, pos) * side(s, t.b);
+    if (sa <= 0 && sb <= 0)
+        return sa < 0 || sb < 0;
+
+    const qreal ta = side(t, pos) * side(t, s.a);
+    const qreal tb = side(t, pos) * side(t, s.b);
+    return ta >= 0 && tb >= 0 && (ta > 0 || tb > 0);
+}
+
+// whether s hides point p from pos
+static bool hides(const BspTree::Segment &s, const QPointF &p, const QPointF &pos)
+{
+    if (side(s, pos) * side(s, p) >= 0)
+        return false;
+
+    QPointF sa = s.a - pos;
+    QPointF sb = s.b - pos;
+    if (cross(sa, sb) < 0)
+        qSwap(sa, sb);
+
+    const QPointF d = p - pos;
+    return cross(sa, d) > 0 && cross(d, sb) > 0;
+}
+
+BspTree::BspTree()
+{
+}
+
+void BspTree::clear()
+{
+    m_nodes.clear();
+    m_segments.clear();
+    m_endpoints.clear();
+}
+
+void BspTree::build(const QVector<Segment> &segments)
+{
+    clear();
+    if (!segments.isEmpty())
+        build(segments, 0);
+
+    foreach (const Segment &segment, m_segments)
+        m_endpoints.append(segment.a, segment.b);
+}
+
+int BspTree::build(const QVector<Segment> &segments, int depth)
+{
+    Node node;
+    node.bounds = segmentBounds(segments);
+    node.axis = -1;
+    node.value = 0;
+    node.children[0] = -1;
+    node.children[1] = -1;
+    node.first = 0;
+    node.count = 0;
+    node.total = 0;
+
+    const int index = m_nodes.size();
+    m_nodes << node;
+
+    int axis;
+    qreal value;
+    if (segments.size() <= maxLeafSize || depth >= maxDepth || !chooseSplit(segments, &axis, &value)) {
+        m_nodes[index].first = m_segments.size();
+        m_nodes[index].count = segments.size();
+        m_nodes[index].total = segments.size();
+        m_segments += segments;
+        return index;
+    }
+
+    QVector<Segment> on;
+    QVector<Segment> sides[2];
+    foreach (const Segment &segment, segments) {
+        switch (classify(segment, axis, value)) {
+        case 0:
+            on << segment;
+            break;
+        case -1:
+            sides[0] << segment;
+            break;
+        case 1:
+            sides[1] << segment;
+            break;
+        default: {
+            const qreal da = coordinate(segment.a, axis) - value;
+            const qreal db = coordinate(segment.b, axis) - value;
+            const QPointF p = segment.a + (segment.b - segment.a) * (da / (da - db));
+
+            Segment first = segment;
+            Segment second = segment;
+            first.b = p;
+            second.a = p;
+            sides[da < 0 ? 0 : 1] << first;
+            sides[da < 0 ? 1 : 0] << second;
+            break;
+        }
+        }
+    }
+
+    m_nodes[index].axis = axis;
+    m_nodes[index].value = value;
+    m_nodes[index].first = m_segments.size();
+    m_nodes[index].count = on.size();
+    m_segments += on;
+
+    for (int i = 0; i < 2; ++i) {
+        if (!sides[i].isEmpty()) {
+            const int child = build(sides[i], depth + 1);
+            m_nodes[index].children[i] = child;
+        }
+    }
+    m_nodes[index].total = m_segments.size() - m_nodes[index].first;
+
+    return index;
+}
+
+// picks the splitting line that balances the two sides best while cutting
+// as few segments as possible, from a handful of candidate coordinates
+bool BspTree::chooseSplit(const QVector<Segment> &segments, int *bestAxis, qreal *bestValue) const
+{
+    const int sampleCount = 9;
+    int bestCost = -1;
+
+    for (int axis = 0; axis < 2; ++axis) {
+        QVector<qreal> coordinates;
+        coordinates.reserve(segments.size() * 2);
+        foreach (const Segment &segment, segments) {
+            coordinates << coordinate(segment.a, axis);
+            coordinates << coordinate(segment.b, axis);
+        }
+        qSort(coordinates);
+
+        const qreal low = coordinates.first();
+        const qreal high = coordinates.last();
+        if (high - low < epsilon)
+            continue;
+
+        for (int sample = 1; sample < sampleCount; ++sample) {
+            const qreal value = coordinates.at(sample * (coordinates.size() - 1) / sampleCount);
+            if (value - low < epsilon || high - value < epsilon)
+                continue;
+
+            int counts[3] = { 0, 0, 0 };
+            foreach (const Segment &segment, segments) {
+                switch (classify(segment, axis, value)) {
+                case -1:
+                    ++counts[0];
+                    break;
+                case 1:
+                    ++counts[1];
+                    break;
+                case 2:
+                    ++counts[2];
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (counts[0] + counts[2] == segments.size() || counts[1] + counts[2] == segments.size())
+                continue;
+
+            // a segment cut in two puts its item in two places of the
+            // drawing order, see segmentRank(), so any split that cuts
+            // nothing is taken over one that does
+            const int cost = qAbs(counts[0] - counts[1]) + segments.size() * counts[2];
+            if (bestCost < 0 || cost < bestCost) {
+                bestCost = cost;
+                *bestAxis = axis;
+                *bestValue = value;
+            }
+        }
+    }
+
+    return bestCost >= 0;
+}
+
+void BspTree::traverse(const QPointF &pos, Visitor *visitor) const
+{
+    if (!m_nodes.isEmpty())
+        traverse(0, pos, visitor);
+}
+
+bool BspTree::traverse(int index, const QPointF &pos, Visitor *visitor) const
+{
+    const Node &node = m_nodes.at(index);
+    if (!visitor->acceptNode(node.bounds))
+        return true;
+
+    int nearSide = 0;
+    if (node.axis >= 0 && coordinate(pos, node.axis) >= node.value)
+        nearSide = 1;
+
+    if (node.children[nearSide] >= 0 && !traverse(node.children[nearSide], pos, visitor))
+        return false;
+
+    if (node.count && !visitor->visitSegments(node.first, node.count))
+        return false;
+
+    if (node.children[1 - nearSide] >= 0 && !traverse(node.children[1 - nearSide], pos, visitor))
+        return false;
+
+    return true;
+}
+
+int BspTree::subtreeSize(int index) const
+{
+    return index < 0 ? 0 : m_nodes.at(index).total;
+}
+
+// the segments of a leaf front to back, a segment is only taken once no
+// other one left hides it
+void BspTree::sortLeaf(const Node &node, const QPointF &pos, QVector<int> *order) const
+{
+    QVector<int> left;
+    for (int i = node.first; i < node.first + node.count; ++i)
+        left << i;
+
+    order->clear();
+    while (!left.isEmpty()) {
+        int pick = 0;
+        for (int i = 0; i < left.size(); ++i) {
+            bool hidden = false;
+            for (int j = 0; j < left.size() && !hidden; ++j)
+                hidden = j != i && hides(m_segments.at(left.at(j)), m_segments.at(left.at(i)), pos);
+            if (!hidden) {
+                pick = i;
+                break;
+            }
+        }
+        *order << left.at(pick);
+        left.remove(pick);
+    }
+}
+
+int BspTree::segmentRank(const QPointF &pos, int segment) const
+{
+    int rank = 0;
+    int index = 0;
+    for (;;) {
+        const Node &node = m_nodes.at(index);
+        if (node.axis < 0) {
+            QVector<int> order;
+            sortLeaf(node, pos, &order);
+            return rank + order.indexOf(segment);
+        }
+
+        const int nearSide = coordinate(pos, node.axis) >= node.value ? 1 : 0;
+        const int nearSize = subtreeSize(node.children[nearSide]);
+
+        // segments on the splitting line can not hide each other
+        if (segment < node.first + node.count)
+            return rank + nearSize + segment - node.first;
+
+        const int lower = node.children[0];
+        const int side = lower >= 0 && segment < m_nodes.at(lower).first + m_nodes.at(lower).total ? 0 : 1;
+        if (side != nearSide)
+            rank += nearSize + node.count;
+        index = node.children[side];
+    }
+}
+
+int BspTree::pointRank(const QPointF &pos, const QPointF &p) const
+{
+    int rank = 0;
+    int index = m_nodes.isEmpty() ? -1 : 0;
+    while (index >= 0) {
+        const Node &node = m_nodes.at(index);
+        if (node.axis < 0) {
+            QVector<int> order;
+            sortLeaf(node, pos, &order);
+
+            int last = -1;
+            for (int i = 0; i < order.size(); ++i) {
+                if (hides(m_segments.at(order.at(i)), p, pos))
+                    last = i;
+            }
+            return rank + last + 1;
+        }
+
+        // a point on the splitting line is in front of the segments on it
+        const int nearSide = coordinate(pos, node.axis) >= node.value ? 1 : 0;
+        const qreal d = coordinate(p, node.axis) - node.value;
+        const int side = qAbs(d) < epsilon ? nearSide : d >= 0 ? 1 : 0;
+        if (side != nearSide)
+            rank += subtreeSize(node.children[nearSide]) + node.count;
+        index = node.children[side];
+    }
+    return rank;
+}
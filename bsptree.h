@@ -0,0 +1,97 @@
+#ifndef BSPTREE_H
+#define BSPTREE_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+#include "segmentstore.h"
+
+class ProjectedItem;
+
+// 2D BSP tree over static wall segments. The maze walls are axis aligned,
+// so the tree only uses horizontal and vertical splitting lines. Segments
+// crossing a splitting line are cut in two, both halves refer to the same
+// item.
+class BspTree
+{
+public:
+    struct Segment
+    {
+        ProjectedItem *item;
+
+        // identifies the item to the user of the tree
+        int index;
+
+        QPointF a;
+        QPointF b;
+    };
+
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() {}
+
+        // return false to skip the subtree covering bounds
+        virtual bool acceptNode(const QRectF &bounds) = 0;
+
+        // called with the range of segments of one node, which are in no
+        // particular order, return false to end the traversal
+        virtual bool visitSegments(int first, int count) = 0;
+    };
+
+    BspTree();
+
+    void build(const QVector<Segment> &segments);
+    void clear();
+
+    bool isEmpty() const { return m_nodes.isEmpty(); }
+
+    // segments after splitting, grouped by node
+    int segmentCount() const { return m_segments.size(); }
+    const Segment &segment(int index) const { return m_segments.at(index); }
+    const SegmentStore &endpoints() const { return m_endpoints; }
+
+    // visits all segments ordered front to back as seen from pos
+    void traverse(const QPointF &pos, Visitor *visitor) const;
+
+    // the place of segment in the front to back order traverse() visits
+    // the segments in from pos, with the segments of each leaf sorted so
+    // that none comes after a segment it hides
+    int segmentRank(const QPointF &pos, int segment) const;
+
+    // the number of segments in that order up to the last one hiding p
+    int pointRank(const QPointF &pos, const QPointF &p) const;
+
+private:
+    struct Node
+    {
+        QRectF bounds;
+
+        // 0 splits at x == value, 1 at y == value, -1 for leaves
+        int axis;
+        qreal value;
+
+        // subtrees on the lower and higher side of the split, or -1
+        int children[2];
+
+        // segments lying on the splitting line, or all segments of a leaf
+        int first;
+        int count;
+
+        // number of segments in the whole subtree, all stored from first on
+        int total;
+    };
+
+    int build(const QVector<Segment> &segments, int depth);
+    bool chooseSplit(const QVector<Segment> &segments, int *axis, qreal *value) const;
+    bool traverse(int index, const QPointF &pos, Visitor *visitor) const;
+    int subtreeSize(int index) const;
+    void sortLeaf(const Node &node, const QPointF &pos, QVector<int> *order) const;
+
+    QVector<Node> m_nodes;
+    QVector<Segment> m_segments;
+    SegmentStore m_endpoints;
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "collisiongrid.h"
+
+#include <qalgorithms.h>
+#include <qmath.h>
+
+#include <QPair>
+
+CollisionGrid::CollisionGrid()
+    : m_width(0)
+    , m_height(0)
+{
+}
+
+void CollisionGrid::setSize(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+
+    m_wallStart.fill(0, width * height + 1);
+    m_walls.clear();
+    m_solidStart.fill(0, width * height + 1);
+    m_solidRects.clear();
+    m_doorStart.fill(0, width * height + 1);
+    m_doorRects.clear();
+
+    m_firstEntity.fill(-1, width * height);
+    m_nextEntity.clear();
+    m_entityCell.clear();
+}
+
+// buckets the rectangles given by indices into every cell they touch,
+// start receives the offset of each cell's range in the result
+static QVector<int> bucket(const CollisionGrid &grid, int cellCount, const QVector<QRectF> &rects,
+                           const QVector<int> &indices, QVector<int> *start)
+{
+    // count the rectangles per cell first, then fill them in place
+    QVector<int> counts(cellCount + 1, 0);
+    foreach (int index, indices) {
+        const QRect cells = grid.cellRange(rects.at(index));
+        for (int y = cells.top(); y <= cells.bottom(); ++y) {
+            for (int x = cells.left(); x <= cells.right(); ++x)
+                ++counts[grid.cellIndex(x, y)];
+        }
+    }
+
+    start->resize(cellCount + 1);
+    int offset = 0;
+    for (int i = 0; i <= cellCount; ++i) {
+        (*start)[i] = offset;
+        offset += counts.at(i);
+    }
+
+    QVector<int> result(offset);
+    QVector<int> fill = *start;
+    foreach (int index, indices) {
+        const QRect cells = grid.cellRange(rects.at(index));
+        for (int y = cells.top(); y <= cells.bottom(); ++y) {
+            for (int x = cells.left(); x <= cells.right(); ++x)
+                result[fill[grid.cellIndex(x, y)]++] = index;
+        }
+    }
+    return result;
+}
+
+void CollisionGrid::setWalls(const QVector<QRectF> &walls, const QVector<WallKind> &kinds)
+{
+    const int cellCount = m_width * m_height;
+
+    QVector<int> all;
+    QVector<int> solid;
+    QVector<int> doors;
+    for (int i = 0; i < walls.size(); ++i) {
+        all << i;
+        if (kinds.at(i) == Solid)
+            solid << i;
+        else if (kinds.at(i) == Door)
+            doors << i;
+    }
+
+    m_walls = bucket(*this, cellCount, walls, all, &m_wallStart);
+
+    m_solidRects.clear();
+    foreach (int wall, bucket(*this, cellCount, walls, solid, &m_solidStart))
+        m_solidRects.append(walls.at(wall));
+
+    m_doorRects.clear();
+    foreach (int wall, bucket(*this, cellCount, walls, doors, &m_doorStart))
+        m_doorRects.append(walls.at(wall));
+}
+
+QRect CollisionGrid::cellRange(const QRectF &rect) const
+{
+    const QRectF r = rect.normalized();
+    const int left = qBound(0, qFloor(r.left()), m_width - 1);
+    const int top = qBound(0, qFloor(r.top()), m_height - 1);
+    const int right = qBound(0, qFloor(r.right()), m_width - 1);
+    const int bottom = qBound(0, qFloor(r.bottom()), m_height - 1);
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+int CollisionGrid::cellOf(const QPointF &pos) const
+{
+    const int x = qBound(0, qFloor(pos.x()), m_width - 1);
+    const int y = qBound(0, qFloor(pos.y()), m_height - 1);
+    return cellIndex(x, y);
+}
+
+void CollisionGrid::moveEntity(int entity, const QPointF &pos)
+{
+    if (entity >= m_entityCell.size()) {
+        const int oldSize = m_entityCell.size();
+        m_entityCell.resize(entity + 1);
+        m_nextEntity.resize(entity + 1);
+        for (int i = oldSize; i <= entity; ++i)
+            m_entityCell[i] = -1;
+    }
+
+    const int cell = cellOf(pos);
+    if (m_entityCell.at(entity) == cell)
+        return;
+
+    unlinkEntity(entity);
+
+    m_entityCell[entity] = cell;
+    m_nextEntity[entity] = m_firstEntity.at(cell);
+    m_firstEntity[cell] = entity;
+}
+
+void CollisionGrid::unlinkEntity(int entity)
+{
+    const int cell = m_entityCell.at(entity);
+    if (cell < 0)
+        return;
+
+    int *link = &m_firstEntity[cell];
+    while (*link != entity)
+        link = &m_nextEntity[*link];
+    *link = m_nextEntity.at(entity);
+}
+
+// the walls of consecutive cells in a row are stored next to each other,
+// so every row of cells is a single run for the rectangle store
+qreal CollisionGrid::sweepWalls(const QRectF &box, Qt::Orientation orientation, qreal distance,
+                                const QRect &cells, bool doorsBlock) const
+{
+    for (int y = cells.top(); y <= cells.bottom() && distance != 0; ++y) {
+        const int first = cellIndex(cells.left(), y);
+        const int last = cellIndex(cells.right(), y) + 1;
+
+        distance = m_solidRects.sweep(box, orientation, distance,
+                                      m_solidStart.at(first), m_solidStart.at(last));
+        if (doorsBlock)
+            distance = m_doorRects.sweep(box, orientation, distance,
+                                         m_doorStart.at(first), m_doorStart.at(last));
+    }
+    return distance;
+}
+
+void CollisionGrid::beginBatch(const QVector<QRectF> &entities)
+{
+    QVector<QPair<int, int> > order;
+    for (int i = 0; i < entities.size(); ++i)
+        order << qMakePair(cellOf(entities.at(i).center()), i);
+    qSort(order);
+
+    m_batchCells.resize(order.size());
+    m_batchSlots.resize(order.size());
+    m_batchRects.resize(order.size());
+    for (int slot = 0; slot < order.size(); ++slot) {
+        const int entity = order.at(slot).second;
+        m_batchCells[slot] = order.at(slot).first;
+        m_batchSlots[entity] = slot;
+        m_batchRects.set(slot, entities.at(entity));
+    }
+}
+
+void CollisionGrid::setBatchEntity(int entity, const QRectF &rect)
+{
+    m_batchRects.set(m_batchSlots.at(entity), rect);
+}
+
+qreal CollisionGrid::sweepBatchEntities(const QRectF &box, Qt::Orientation orientation, qreal distance,
+                                        const QRect &cells, int skipEntity) const
+{
+    const int skip = skipEntity >= 0 ? m_batchSlots.at(skipEntity) : -1;
+
+    for (int y = cells.top(); y <= cells.bottom() && distance != 0; ++y) {
+        const int first = qLowerBound(m_batchCells.constBegin(), m_batchCells.constEnd(),
+                                      cellIndex(cells.left(), y)) - m_batchCells.constBegin();
+        const int last = qUpperBound(m_batchCells.constBegin(), m_batchCells.constEnd(),
+                                     cellIndex(cells.right(), y)) - m_batchCells.constBegin();
+
+        if (skip >= first && skip < last) {
+            distance = m_batchRects.sweep(box, orientation, distance, first, skip);
+            distance = m_batchRects.sweep(box, orientation, distance, skip + 1, last);
+        } else {
+            distance = m_batchRects.sweep(box, orientation, distance, first, last);
+        }
+    }
+    return distance;
+}
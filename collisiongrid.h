@@ -0,0 +1,86 @@
+#ifndef COLLISIONGRID_H
+#define COLLISIONGRID_H
+
+#include <QPointF>
+#include <QRect>
+#include <QRectF>
+#include <QVector>
+
+#include "rectstore.h"
+
+// Buckets the collision rectangles of walls and the positions of entities
+// by map cell, so that a collision query only looks at the few cells
+// around it. Walls are bucketed once, entities are kept in per cell lists
+// that are cheap to update as they move.
+class CollisionGrid
+{
+public:
+    enum WallKind
+    {
+        Solid,
+        Door,
+        Passable
+    };
+
+    CollisionGrid();
+
+    // clears the grid
+    void setSize(int width, int height);
+    void setWalls(const QVector<QRectF> &walls, const QVector<WallKind> &kinds);
+
+    // inserts the entity with the given index, or moves it to pos
+    void moveEntity(int entity, const QPointF &pos);
+
+    // cells touched by rect, clamped to the grid
+    QRect cellRange(const QRectF &rect) const;
+    int cellIndex(int x, int y) const { return y * m_width + x; }
+
+    // range of wall() indices holding the walls touching a cell
+    int wallBegin(int cell) const { return m_wallStart.at(cell); }
+    int wallEnd(int cell) const { return m_wallStart.at(cell + 1); }
+    int wall(int i) const { return m_walls.at(i); }
+
+    // entities in a cell as a linked list ended by -1
+    int firstEntity(int cell) const { return m_firstEntity.at(cell); }
+    int nextEntity(int entity) const { return m_nextEntity.at(entity); }
+
+    // how far box can move along one axis, up to distance, before it
+    // touches a wall in cells, doors only count if doorsBlock is set
+    qreal sweepWalls(const QRectF &box, Qt::Orientation orientation, qreal distance,
+                     const QRect &cells, bool doorsBlock) const;
+
+    // Batched moves work on a copy of all entity rectangles sorted by
+    // cell. The copy of an entity follows it as it moves, but stays in
+    // the bucket of its cell at the start of the batch, so queries have
+    // to look as far around as entities move during the batch.
+    void beginBatch(const QVector<QRectF> &entities);
+    void setBatchEntity(int entity, const QRectF &rect);
+    qreal sweepBatchEntities(const QRectF &box, Qt::Orientation orientation, qreal distance,
+                             const QRect &cells, int skipEntity) const;
+
+private:
+    int cellOf(const QPointF &pos) const;
+    void unlinkEntity(int entity);
+
+    int m_width;
+    int m_height;
+
+    QVector<int> m_wallStart;
+    QVector<int> m_walls;
+
+    // wall rectangles bucketed like m_walls, without passable walls
+    QVector<int> m_solidStart;
+    RectStore m_solidRects;
+    QVector<int> m_doorStart;
+    RectStore m_doorRects;
+
+    QVector<int> m_batchCells;
+    QVector<int> m_batchSlots;
+    RectStore m_batchRects;
+
+    QVector<int> m_firstEntity;
+    QVector<int> m_nextEntity;
+    QVector<int> m_entityCell;
+};
+
+#endif
@@ -1,18 +1,6 @@
 #include "entity.h"
 
-const QImage toAlpha(const QImage &image)
-{
-    if (image.isNull())
-        return image;
-    QRgb alpha = image.pixel(0, 0);
-    QImage result = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
-    QRgb *data = reinterpret_cast<QRgb *>(result.bits());
-    int size = image.width() * image.height();
-    for (int i = 0; i < size; ++i)
-        if (data[i] == alpha)
-            data[i] = 0;
-    return result;
-}
+#include "atlas.h"
 
 Entity::Entity(const QPointF &pos)
     : ProjectedItem(QRectF(-0.5, -0.3, 0.6, 0.9), false, false)
@@ -20,52 +8,106 @@ Entity::Entity(const QPointF &pos)
     , m_angle(180)
     , m_walking(false)
     , m_walked(false)
+    , m_turned(false)
     , m_turnVelocity(0)
     , m_useTurnTarget(false)
     , m_animationIndex(0)
+    , m_imageIndex(-1)
     , m_angleIndex(0)
 {
-    startTimer(300);
+    m_displayed = state();
+}
+
+// the slots are called by scripts on the GUI thread, they hand the
+// command over to the simulation
+void Entity::post(SimulationInput::Type type, qreal x, qreal y)
+{
+    SimulationInput input(type, x, y);
+    input.entity = this;
+
+    if (MazeScene *maze = static_cast<MazeScene *>(scene()))
+        maze->post(input);
+    else
+        apply(input);
 }
 
 void Entity::walk()
 {
-    m_walking = true;
+    post(SimulationInput::EntityWalk);
 }
 
 void Entity::stop()
 {
-    m_walking = false;
-    m_useTurnTarget = false;
-    m_turnVelocity = 0;
+    post(SimulationInput::EntityStop);
 }
 
 void Entity::turnTowards(qreal x, qreal y)
 {
-    m_turnTarget = QPointF(x, y);
-    m_useTurnTarget = true;
+    post(SimulationInput::EntityTurnTowards, x, y);
 }
 
 void Entity::turnLeft()
 {
-    m_useTurnTarget = false;
-    m_turnVelocity = -0.5;
+    post(SimulationInput::EntityTurnLeft);
 }
 
 void Entity::turnRight()
 {
-    m_useTurnTarget = false;
-    m_turnVelocity = 0.5;
+    post(SimulationInput::EntityTurnRight);
 }
 
-static QVector<QImage> loadSoldierImages()
+void Entity::apply(const SimulationInput &input)
 {
-    QVector<QImage> images;
-    for (int i = 1; i <= 40; ++i) {
-        QImage image(QString("character/O%0.png").arg(i, 2, 10, QLatin1Char('0')));
-        images << toAlpha(image.convertToFormat(QImage::Format_RGB32));
+    switch (input.type) {
+    case SimulationInput::EntityWalk:
+        m_walking = true;
+        break;
+    case SimulationInput::EntityStop:
+        m_walking = false;
+        m_useTurnTarget = false;
+        m_turnVelocity = 0;
+        break;
+    case SimulationInput::EntityTurnTowards:
+        m_turnTarget = QPointF(input.x, input.y);
+        m_useTurnTarget = true;
+        break;
+    case SimulationInput::EntityTurnLeft:
+        m_useTurnTarget = false;
+        m_turnVelocity = -0.5;
+        break;
+    case SimulationInput::EntityTurnRight:
+        m_useTurnTarget = false;
+        m_turnVelocity = 0.5;
+        break;
+    case SimulationInput::Script:
+        emit scriptReplayed(input.text);
+        break;
+    default:
+        break;
     }
-    return images;
+}
+
+EntityState Entity::state() const
+{
+    EntityState state;
+    state.pos = m_pos;
+    state.angle = m_angle;
+    state.walked = m_walked;
+    return state;
+}
+
+void Entity::setDisplayedState(const EntityState &state)
+{
+    m_displayed = state;
+}
+
+void Entity::setAnimationFrame(int frame)
+{
+    m_animationIndex = frame;
+
+    // obscured entities pick the frame up when they come into view
+    if (!isObscured())
+        updateImage();
 }
 
 static inline int mod(int x, int y)
@@ -73,23 +115,60 @@ static inline int mod(int x, int y)
     return ((x % y) + y) % y;
 }
 
-void Entity::updateTransform(const Camera &camera)
+// the sprite turns towards camera in steps of 45 degrees, angleIndex is
+// the direction the entity is seen from
+void Entity::face(const Camera &camera, QPointF *a, QPointF *b, int *angleIndex) const
 {
-    qreal angleToCamera = QLineF(m_pos, camera.pos()).angle();
+    const QPointF pos = m_displayed.pos;
+    qreal angleToCamera = QLineF(pos, camera.pos()).angle();
     int cameraAngleIndex = mod(qRound(angleToCamera + 22.5), 360) / 45;
 
-    m_angleIndex = mod(qRound(cameraAngleIndex * 45 - m_angle + 22.5), 360) / 45;
+    *angleIndex = mod(qRound(cameraAngleIndex * 45 - m_displayed.angle + 22.5), 360) / 45;
 
     QPointF delta = QLineF::fromPolar(1, 270.1 + 45 * cameraAngleIndex).p2();
-    setPosition(m_pos - delta, m_pos + delta);
+    *a = pos - delta;
+    *b = pos + delta;
+}
 
-    updateImage();
-    ProjectedItem::updateTransform(camera);
+void Entity::updateTransform(const Camera &camera, const QTransform &screen)
+{
+    QPointF a;
+    QPointF b;
+    face(camera, &a, &b, &m_angleIndex);
+    setPosition(a, b);
+
+    if (!isObscured())
+        updateImage();
+    ProjectedItem::updateTransform(camera, screen);
 }
 
-bool Entity::move(MazeScene *scene)
+// observers see the entity turned towards their own camera
+bool Entity::project(const Camera &camera, QTransform *transform, qreal *depth) const
 {
-    bool moved = false;
+    QPointF a;
+    QPointF b;
+    int angleIndex;
+    face(camera, &a, &b, &angleIndex);
+    return projectPlacement(camera, a, b, modelMatrixFor(a, b), transform, depth);
+}
+
+void Entity::paintFrom(const Camera &camera, QPainter *painter)
+{
+    QPointF a;
+    QPointF b;
+    int angleIndex;
+    face(camera, &a, &b, &angleIndex);
+
+    const Atlas &frames = AssetPack::instance().soldier();
+    painter->drawImage(boundingRect(), frames.image(), frames.rect(frameIndex(angleIndex)));
+}
+
+QPointF Entity::plan(int elapsed)
+{
+    // turning and walking speeds are given per 5 ms
+    const qreal scale = elapsed / qreal(5);
+
+    m_turned = false;
     if (m_useTurnTarget) {
         qreal angleToTarget = QLineF::fromPolar(1, m_angle)
             .angleTo(QLineF(m_pos, m_turnTarget));
@@ -99,39 +178,48 @@ bool Entity::move(MazeScene *scene)
                 angleToTarget -= 360;
 
             if (angleToTarget < 0)
-                m_angle -= qMin(-angleToTarget, qreal(0.5));
+                m_angle -= qMin(-angleToTarget, 0.5 * scale);
             else
-                m_angle += qMin(angleToTarget, qreal(0.5));
-            moved = true;
+                m_angle += qMin(angleToTarget, 0.5 * scale);
+            m_turned = true;
         }
     } else if (m_turnVelocity != 0) {
-        m_angle += m_turnVelocity;
-        moved = true;
+        m_angle += m_turnVelocity * scale;
+        m_turned = true;
     }
 
-    m_walked = false;
-    if (m_walking) {
-        QPointF walkingDelta = QLineF::fromPolar(0.006, m_angle).p2();
-        if (scene->tryMove(m_pos, walkingDelta, this)) {
-            moved = true;
-            m_walked = true;
-        }
-    }
+    if (!m_walking)
+        return QPointF();
 
-    return moved;
+    return QLineF::fromPolar(0.006 * scale, m_angle).p2();
+}
+
+bool Entity::finishMove(const QPointF &pos)
+{
+    m_walked = pos != m_pos;
+    m_pos = pos;
+    return m_turned || m_walked;
 }
 
-void Entity::timerEvent(QTimerEvent *)
+// the atlas frame for the direction and the walking animation
+int Entity::frameIndex(int angleIndex) const
 {
-    ++m_animationIndex;
-    updateImage();
+    int index = angleIndex;
+    if (m_displayed.walked)
+        index += 8 + 8 * (m_animationIndex % 4);
+    return index;
 }
 
 void Entity::updateImage()
 {
-    static QVector<QImage> images = loadSoldierImages();
-    if (m_walked)
-        setImage(images.at(8 + 8 * (m_animationIndex % 4) + m_angleIndex));
-    else
-        setImage(images.at(m_angleIndex));
+    const Atlas &frames = AssetPack::instance().soldier();
+
+    const int index = frameIndex(m_angleIndex);
+
+    // setImage() repaints the item
+    if (index == m_imageIndex)
+        return;
+
+    m_imageIndex = index;
+    setImage(frames.image(), frames.rect(index));
 }
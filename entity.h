@@ -5,17 +5,38 @@
 #include <QObject>
 
 #include "mazescene.h"
+#include "simulation.h"
 
 class Entity : public QObject, public ProjectedItem
 {
     Q_OBJECT
 public:
     Entity(const QPointF &pos);
-    void updateTransform(const Camera &camera);
+    void updateTransform(const Camera &camera, const QTransform &screen = QTransform());
+    bool project(const Camera &camera, QTransform *transform, qreal *depth) const;
+    void paintFrom(const Camera &camera, QPainter *painter);
 
+    // the simulated position, on the simulation thread
     QPointF pos() const { return m_pos; }
+    EntityState state() const;
+    bool isActive() const { return m_walking || m_turned || m_turnVelocity != 0; }
+    void apply(const SimulationInput &input);
 
-    bool move(MazeScene *scene);
+    // the state drawn, on the GUI thread
+    QPointF displayedPos() const { return m_displayed.pos; }
+    const EntityState &displayedState() const { return m_displayed; }
+    void setDisplayedState(const EntityState &state);
+
+    // frame of the walking animation, from the clock of the scene
+    void setAnimationFrame(int frame);
+
+    // advancing the entity by elapsed milliseconds takes two steps, so that
+    // MazeScene::moveEntities() can resolve the walking of all entities at
+    // once: plan() turns the entity and returns how far it wants to walk,
+    // finishMove() takes the position it got to and returns whether the
+    // entity moved at all
+    QPointF plan(int elapsed);
+    bool finishMove(const QPointF &pos);
 
 public slots:
     void turnTowards(qreal x, qreal y);
@@ -24,24 +45,32 @@ public slots:
     void walk();
     void stop();
 
-protected:
-    void timerEvent(QTimerEvent *event);
+signals:
+    // a replay reached a change of the script, on the simulation thread
+    void scriptReplayed(const QString &source);
 
 private:
+    void face(const Camera &camera, QPointF *a, QPointF *b, int *angleIndex) const;
+    int frameIndex(int angleIndex) const;
     void updateImage();
+    void post(SimulationInput::Type type, qreal x = 0, qreal y = 0);
 
 private:
     QPointF m_pos;
     qreal m_angle;
     bool m_walking;
     bool m_walked;
+    bool m_turned;
 
     qreal m_turnVelocity;
     QPointF m_turnTarget;
 
     bool m_useTurnTarget;
 
+    EntityState m_displayed;
+
     int m_animationIndex;
+    int m_imageIndex;
     int m_angleIndex;
 };
 
@@ -0,0 +1,250 @@
+#include "floorcaster.h"
+
+#include <QPainter>
+#include <qmath.h>
+
+#include <limits>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// the images repeat every half scene unit
+static const int repeatsPerUnit = 2;
+
+// pixels further away than this are left out, they are at the horizon
+// behind the walls anyway and their texture coordinates would overflow
+static const float minInverseDepth = 1.0f / 4096;
+
+FloorCaster::FloorCaster()
+{
+}
+
+// keeps a copy of image in 32 bits with power of two sides, so that
+// repeating it is a mask
+void FloorCaster::setTexture(Texture *texture, const QImage &image)
+{
+    if (texture->key == image.cacheKey())
+        return;
+
+    texture->key = image.cacheKey();
+    texture->image = QImage();
+    if (image.isNull())
+        return;
+
+    int width = 1;
+    while (width < image.width())
+        width *= 2;
+    int height = 1;
+    while (height < image.height())
+        height *= 2;
+
+    QImage converted = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    if (converted.size() != QSize(width, height))
+        converted = converted.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    texture->image = converted;
+}
+
+// maps a point of a plane to the device, unless it is behind the camera
+static bool project(const QTransform &transform, const QPointF &p, QPointF *result)
+{
+    const qreal w = transform.m13() * p.x() + transform.m23() * p.y() + transform.m33();
+    if (w <= minInverseDepth)
+        return false;
+
+    *result = QPointF((transform.m11() * p.x() + transform.m21() * p.y() + transform.m31()) / w,
+                      (transform.m12() * p.x() + transform.m22() * p.y() + transform.m32()) / w);
+    return true;
+}
+
+// Projects the bottom edge of the walls onto the rows of each column of
+// rect for the floor, and the top edge for the ceiling. Where walls
+// overlap, the one that leaves the most floor or ceiling wins, and columns
+// no wall covers are filled completely, so nothing is left out that the
+// walls do not paint over.
+static void wallLimits(const QVector<QLineF> &walls, const QTransform &plane, const QRect &rect, bool floor,
+                       QVector<int> *limits)
+{
+    const int unset = floor ? std::numeric_limits<int>::max() : std::numeric_limits<int>::min();
+    limits->fill(unset, rect.width());
+    int *data = limits->data();
+
+    foreach (const QLineF &wall, walls) {
+        QPointF a;
+        QPointF b;
+        if (!project(plane, wall.p1(), &a) || !project(plane, wall.p2(), &b))
+            continue;
+        if (a.x() > b.x())
+            qSwap(a, b);
+
+        const int first = qMax(rect.left(), qCeil(a.x() - 0.5));
+        const int last = qMin(rect.right(), qFloor(b.x() - 0.5));
+        const qreal slope = b.x() > a.x() ? (b.y() - a.y()) / (b.x() - a.x()) : 0;
+        for (int x = first; x <= last; ++x) {
+            const qreal y = qBound(qreal(rect.top() - 2), a.y() + (x + 0.5 - a.x()) * slope,
+                                   qreal(rect.bottom() + 2));
+
+            // a row of slack for the edge pixels the walls blend
+            int &limit = data[x - rect.left()];
+            if (floor)
+                limit = qMin(limit, qFloor(y) - 1);
+            else
+                limit = qMax(limit, qCeil(y) + 1);
+        }
+    }
+
+    for (int i = 0; i < rect.width(); ++i) {
+        if (data[i] == unset)
+            data[i] = floor ? rect.top() : rect.bottom() + 1;
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128i floorToInt(__m128 x)
+{
+    const __m128i truncated = _mm_cvttps_epi32(x);
+
+    // truncating rounds negative numbers up, take one off where it did
+    const __m128 roundedUp = _mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), x);
+    return _mm_add_epi32(truncated, _mm_castps_si128(roundedUp));
+}
+#endif
+
+// Fills the pixels of row y that show the plane, the floor where y is at or
+// below the limit of the column, the ceiling where it is above. inverse maps
+// device coordinates to homogeneous plane coordinates, which change
+// linearly along the row.
+void FloorCaster::castRow(QRgb *line, int y, const QRect &rect, const QTransform &inverse,
+                          const Texture &texture, const int *limits, bool below) const
+{
+    const float cy = y + 0.5f;
+    const float du = inverse.m11();
+    const float dv = inverse.m12();
+    const float dw = inverse.m13();
+    const float u0 = inverse.m21() * cy + inverse.m31();
+    const float v0 = inverse.m22() * cy + inverse.m32();
+    const float w0 = inverse.m23() * cy + inverse.m33();
+
+    // the plane is behind the camera along the whole row
+    const float left = rect.left() + 0.5f;
+    const float right = rect.right() + 0.5f;
+    if (w0 + dw * left <= minInverseDepth && w0 + dw * right <= minInverseDepth)
+        return;
+
+    const int width = texture.image.width();
+    const int height = texture.image.height();
+    int shift = 0;
+    while ((1 << shift) < width)
+        ++shift;
+    const float scaleX = repeatsPerUnit * width;
+    const float scaleY = repeatsPerUnit * height;
+    const QRgb *texels = reinterpret_cast<const QRgb *>(texture.image.constBits());
+
+    const int count = rect.width();
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vdu = _mm_set1_ps(du);
+    const __m128 vdv = _mm_set1_ps(dv);
+    const __m128 vdw = _mm_set1_ps(dw);
+    const __m128 vu0 = _mm_set1_ps(u0);
+    const __m128 vv0 = _mm_set1_ps(v0);
+    const __m128 vw0 = _mm_set1_ps(w0);
+    const __m128 vscaleX = _mm_set1_ps(scaleX);
+    const __m128 vscaleY = _mm_set1_ps(scaleY);
+    const __m128 vminW = _mm_set1_ps(minInverseDepth);
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128i maskX = _mm_set1_epi32(width - 1);
+    const __m128i maskY = _mm_set1_epi32(height - 1);
+    const __m128i vy = _mm_set1_epi32(y);
+    const __m128i vshift = _mm_cvtsi32_si128(shift);
+
+    for (; i + 4 <= count; i += 4) {
+        const __m128i limit = _mm_loadu_si128(reinterpret_cast<const __m128i *>(limits + i));
+        __m128i inside = _mm_cmpgt_epi32(limit, vy);
+        if (below)
+            inside = _mm_andnot_si128(inside, _mm_cmpeq_epi32(inside, inside));
+
+        const __m128 x = _mm_add_ps(_mm_set1_ps(float(rect.left() + i)), offsets);
+        const __m128 w = _mm_add_ps(_mm_mul_ps(x, vdw), vw0);
+        inside = _mm_and_si128(inside, _mm_castps_si128(_mm_cmpgt_ps(w, vminW)));
+        if (!_mm_movemask_epi8(inside))
+            continue;
+
+        // lanes outside may divide by zero, the mask keeps their texel
+        // index in range and their pixel as it was
+        const __m128 inverseW = _mm_div_ps(one, w);
+        const __m128 u = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, vdu), vu0), inverseW), vscaleX);
+        const __m128 v = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, vdv), vv0), inverseW), vscaleY);
+        const __m128i tx = _mm_and_si128(floorToInt(u), maskX);
+        const __m128i ty = _mm_and_si128(floorToInt(v), maskY);
+
+        int index[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(index), _mm_or_si128(_mm_sll_epi32(ty, vshift), tx));
+        const __m128i texel = _mm_setr_epi32(texels[index[0]], texels[index[1]], texels[index[2]], texels[index[3]]);
+
+        __m128i *pixels = reinterpret_cast<__m128i *>(line + i);
+        const __m128i old = _mm_loadu_si128(pixels);
+        _mm_storeu_si128(pixels, _mm_or_si128(_mm_and_si128(inside, texel), _mm_andnot_si128(inside, old)));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        if (below ? y < limits[i] : y >= limits[i])
+            continue;
+
+        const float x = rect.left() + i + 0.5f;
+        const float w = w0 + dw * x;
+        if (w <= minInverseDepth)
+            continue;
+
+        const int tx = qFloor((u0 + du * x) / w * scaleX) & (width - 1);
+        const int ty = qFloor((v0 + dv * x) / w * scaleY) & (height - 1);
+        line[i] = texels[(ty << shift) | tx];
+    }
+}
+
+void FloorCaster::draw(QPainter *painter, const QRect &rect, const QTransform &floor, const QTransform &ceiling,
+                       const QVector<QLineF> &walls, const QImage &floorImage, const QImage &ceilingImage)
+{
+    const QRect target = rect & QRect(0, 0, painter->device()->width(), painter->device()->height());
+    if (target.isEmpty())
+        return;
+
+    setTexture(&m_floor, floorImage);
+    setTexture(&m_ceiling, ceilingImage);
+
+    bool floorInvertible;
+    bool ceilingInvertible;
+    const QTransform floorInverse = floor.inverted(&floorInvertible);
+    const QTransform ceilingInverse = ceiling.inverted(&ceilingInvertible);
+    const bool drawFloor = floorInvertible && !m_floor.image.isNull();
+    const bool drawCeiling = ceilingInvertible && !m_ceiling.image.isNull();
+
+    if (drawFloor)
+        wallLimits(walls, floor, target, true, &m_floorTop);
+    if (drawCeiling)
+        wallLimits(walls, ceiling, target, false, &m_ceilingBottom);
+
+    if (m_buffer.width() < target.width() || m_buffer.height() < target.height()) {
+        m_buffer = QImage(qMax(m_buffer.width(), target.width()), qMax(m_buffer.height(), target.height()),
+                          QImage::Format_ARGB32_Premultiplied);
+    }
+
+    // what is neither floor nor ceiling stays transparent
+    for (int y = target.top(); y <= target.bottom(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(m_buffer.scanLine(y - target.top()));
+        memset(line, 0, target.width() * sizeof(QRgb));
+        if (drawFloor)
+            castRow(line, y, target, floorInverse, m_floor, m_floorTop.constData(), true);
+        if (drawCeiling)
+            castRow(line, y, target, ceilingInverse, m_ceiling, m_ceilingBottom.constData(), false);
+    }
+
+    painter->save();
+    painter->resetTransform();
+    painter->drawImage(target.topLeft(), m_buffer, QRect(QPoint(0, 0), target.size()));
+    painter->restore();
+}
@@ -0,0 +1,54 @@
+#ifndef FLOORCASTER_H
+#define FLOORCASTER_H
+
+#include <QImage>
+#include <QLineF>
+#include <QRect>
+#include <QTransform>
+#include <QVector>
+
+class QPainter;
+
+// Draws the floor and the ceiling of a view in software, a scanline at a
+// time. Along a screen row the texture coordinates of a plane change
+// linearly before the perspective divide, so each row only steps them,
+// four pixels at a time with SSE2. Columns are only filled below and above
+// the visible walls, everything the walls cover is skipped.
+class FloorCaster
+{
+public:
+    FloorCaster();
+
+    // floor and ceiling map the scene coordinates of the floor and the
+    // ceiling plane to device coordinates of the painter, walls are the
+    // visible parts of the opaque walls on the floor plane and rect is the
+    // part of the device to fill
+    void draw(QPainter *painter, const QRect &rect, const QTransform &floor, const QTransform &ceiling,
+              const QVector<QLineF> &walls, const QImage &floorImage, const QImage &ceilingImage);
+
+private:
+    struct Texture
+    {
+        Texture() : key(0) {}
+
+        // the image the texture was made from
+        qint64 key;
+        QImage image;
+    };
+
+    static void setTexture(Texture *texture, const QImage &image);
+    void castRow(QRgb *line, int y, const QRect &rect, const QTransform &inverse,
+                 const Texture &texture, const int *limits, bool below) const;
+
+    Texture m_floor;
+    Texture m_ceiling;
+
+    // the first floor row and the row after the last ceiling row of each
+    // column of rect
+    QVector<int> m_floorTop;
+    QVector<int> m_ceilingBottom;
+
+    QImage m_buffer;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "framescheduler.h"
+
+#include <QCoreApplication>
+
+// about the refresh rate of a display, the simulation steps are interpolated
+static const int frameInterval = 16;
+
+static FrameScheduler *theScheduler = 0;
+
+FrameClient::~FrameClient()
+{
+    if (theScheduler)
+        theScheduler->remove(this);
+}
+
+void FrameClient::wake()
+{
+    FrameScheduler::instance()->wake(this);
+}
+
+FrameScheduler *FrameScheduler::instance()
+{
+    if (!theScheduler)
+        theScheduler = new FrameScheduler;
+    return theScheduler;
+}
+
+FrameScheduler::FrameScheduler()
+    : QObject(QCoreApplication::instance())
+    , m_lastTick(0)
+{
+    m_timer.setInterval(frameInterval);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(tick()));
+    m_clock.start();
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    theScheduler = 0;
+}
+
+void FrameScheduler::wake(FrameClient *client)
+{
+    m_busy.insert(client);
+
+    if (!m_timer.isActive()) {
+        m_lastTick = m_clock.elapsed();
+        m_timer.start();
+    }
+}
+
+void FrameScheduler::remove(FrameClient *client)
+{
+    m_busy.remove(client);
+    m_pending.removeAll(client);
+}
+
+void FrameScheduler::tick()
+{
+    const qint64 now = m_clock.elapsed();
+    const int elapsed = now - m_lastTick;
+    m_lastTick = now;
+
+    // clients may wake, or delete, each other while being advanced
+    m_pending = m_busy.toList();
+    m_busy.clear();
+    while (!m_pending.isEmpty()) {
+        FrameClient *client = m_pending.takeFirst();
+        if (client->advanceFrame(elapsed))
+            m_busy.insert(client);
+    }
+
+    if (m_busy.isEmpty())
+        m_timer.stop();
+}
@@ -0,0 +1,56 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+
+// Something that has to be advanced regularly while it is busy, like an
+// animation or a script.
+class FrameClient
+{
+public:
+    virtual ~FrameClient();
+
+    // asks for frames until advanceFrame() returns false, GUI thread only
+    void wake();
+
+protected:
+    // elapsed is in milliseconds since the previous frame, returns
+    // whether another frame is needed
+    virtual bool advanceFrame(int elapsed) = 0;
+
+    friend class FrameScheduler;
+};
+
+// Drives all frame clients from one timer that only runs while any of
+// them is busy, so that a static world does not wake the process up.
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    static FrameScheduler *instance();
+    ~FrameScheduler();
+
+    void wake(FrameClient *client);
+    void remove(FrameClient *client);
+
+private slots:
+    void tick();
+
+private:
+    FrameScheduler();
+
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_lastTick;
+
+    QSet<FrameClient *> m_busy;
+
+    // clients still to be advanced in the current tick
+    QList<FrameClient *> m_pending;
+};
+
+#endif
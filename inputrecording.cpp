@@ -0,0 +1,103 @@
+#include "inputrecording.h"
+
+#include <QDataStream>
+#include <QFile>
+
+static const quint32 fileMagic = 0x4c57494e;
+static const qint32 fileVersion = 1;
+
+InputRecording::InputRecording()
+    : m_seed(0)
+    , m_length(0)
+{
+}
+
+void InputRecording::setSeed(uint seed)
+{
+    m_seed = seed;
+}
+
+void InputRecording::setLength(qint64 length)
+{
+    m_length = length;
+}
+
+void InputRecording::append(const Event &event)
+{
+    m_events << event;
+    m_length = qMax(m_length, event.time);
+}
+
+void InputRecording::clear()
+{
+    m_seed = 0;
+    m_length = 0;
+    m_events.clear();
+}
+
+bool InputRecording::save(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << fileMagic << fileVersion << quint32(m_seed) << m_length << qint32(m_events.size());
+
+    foreach (const Event &event, m_events) {
+        const SimulationInput &input = event.input;
+        stream << event.time << event.wallTime << qint32(event.entity) << qint32(input.type)
+               << double(input.x) << double(input.y) << double(input.yaw) << double(input.pitch)
+               << input.text;
+    }
+
+    return stream.status() == QDataStream::Ok;
+}
+
+bool InputRecording::load(const QString &fileName)
+{
+    clear();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+
+    quint32 magic;
+    qint32 version;
+    quint32 seed;
+    qint64 length;
+    qint32 count;
+    stream >> magic >> version >> seed >> length >> count;
+    if (stream.status() != QDataStream::Ok || magic != fileMagic || version != fileVersion || count < 0)
+        return false;
+
+    m_events.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        Event event;
+        qint32 entity;
+        qint32 type;
+        double x, y, yaw, pitch;
+        stream >> event.time >> event.wallTime >> entity >> type >> x >> y >> yaw >> pitch >> event.input.text;
+
+        event.entity = entity;
+        event.input.type = SimulationInput::Type(type);
+        event.input.x = x;
+        event.input.y = y;
+        event.input.yaw = yaw;
+        event.input.pitch = pitch;
+        m_events << event;
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        clear();
+        return false;
+    }
+
+    m_seed = seed;
+    m_length = length;
+    return true;
+}
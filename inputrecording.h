@@ -0,0 +1,59 @@
+#ifndef INPUTRECORDING_H
+#define INPUTRECORDING_H
+
+#include <QString>
+#include <QVector>
+
+#include "simulation.h"
+
+// Everything the simulation of a scene was told during a run, each input
+// with the step it was handled at, so that Simulation::replay() can take
+// the scene through the same steps again. Only recordings of the same map
+// play back the same way.
+class InputRecording
+{
+public:
+    struct Event
+    {
+        Event()
+            : time(0)
+            , wallTime(0)
+            , entity(-1)
+        {
+        }
+
+        // simulated milliseconds, and milliseconds since the recording
+        // started
+        qint64 time;
+        qint64 wallTime;
+
+        // index into MazeScene::entities(), -1 for input to the scene,
+        // input.entity is not kept
+        int entity;
+        SimulationInput input;
+    };
+
+    InputRecording();
+
+    // the seed of qrand(), which scripts draw their random numbers from
+    uint seed() const { return m_seed; }
+    void setSeed(uint seed);
+
+    // simulated milliseconds when the recording stopped
+    qint64 length() const { return m_length; }
+    void setLength(qint64 length);
+
+    const QVector<Event> &events() const { return m_events; }
+    void append(const Event &event);
+    void clear();
+
+    bool save(const QString &fileName) const;
+    bool load(const QString &fileName);
+
+private:
+    uint m_seed;
+    qint64 m_length;
+    QVector<Event> m_events;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "lightmapbaker.h"
+
+#include <qmath.h>
+
+#include "mazescene.h"
+
+// about 900 scene units of wall with the images of the asset pack
+static const int budget = 64 * 1024;
+
+// the translucent walls have no texture, only a constant shade
+static QImage translucentImage()
+{
+    static QImage image;
+    if (image.isNull()) {
+        image = QImage(1, 1, QImage::Format_ARGB32_Premultiplied);
+        image.fill(qRgba(0, 0, 0, 100));
+    }
+    return image;
+}
+
+LightmapBaker::Baked::~Baked()
+{
+    m_item->setLitImage(QImage());
+}
+
+LightmapBaker::LightmapBaker()
+    : m_baked(budget)
+{
+}
+
+void LightmapBaker::setLights(const QVector<Light> &lights)
+{
+    m_lights = lights;
+    clear();
+}
+
+void LightmapBaker::clear()
+{
+    m_baked.clear();
+}
+
+void LightmapBaker::bake(ProjectedItem *item)
+{
+    // object() also marks the item as the one seen last
+    if (!item->isLit() || m_baked.object(item))
+        return;
+
+    const QImage image = item->image().isNull() ? translucentImage() : bakeWall(item);
+    item->setLitImage(image);
+    m_baked.insert(item, new Baked(item), qMax(1, image.byteCount() / 1024));
+}
+
+// The texture of item over the whole wall, once per scene unit on merged
+// walls and stretched over shorter ones, like ProjectedItem::paint() draws
+// it. Columns of texels are shaded like the shadow items used to blend
+// over them, only at every texel instead of a gradient stop per unit.
+QImage LightmapBaker::bakeWall(const ProjectedItem *item) const
+{
+    QImage texture = item->image().copy(item->sourceRect());
+    if (texture.format() != QImage::Format_RGB32 && texture.format() != QImage::Format_ARGB32_Premultiplied)
+        texture = texture.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    const qreal repeats = qMax(qreal(1), item->boundingRect().width());
+    const int width = qMax(1, qRound(texture.width() * repeats));
+    const int height = texture.height();
+
+    // x runs from b to a, like the x axis of the item
+    QVector<int> columns(width);
+    QVector<int> shades(width);
+    for (int x = 0; x < width; ++x) {
+        const qreal u = (x + 0.5) / width;
+        const qreal s = u * repeats;
+        columns[x] = qBound(0, int((s - qFloor(s)) * texture.width()), texture.width() - 1);
+        shades[x] = 256 * (255 - shadowAlpha(m_lights, item->b() + (item->a() - item->b()) * u)) / 255;
+    }
+
+    QImage image(width, height, texture.format());
+    for (int y = 0; y < height; ++y) {
+        const QRgb *texels = reinterpret_cast<const QRgb *>(texture.constScanLine(y));
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            const QRgb texel = texels[columns.at(x)];
+            const int shade = shades.at(x);
+            line[x] = qRgba(qRed(texel) * shade >> 8, qGreen(texel) * shade >> 8, qBlue(texel) * shade >> 8,
+                            qAlpha(texel));
+        }
+    }
+    return image;
+}
@@ -0,0 +1,55 @@
+#ifndef LIGHTMAPBAKER_H
+#define LIGHTMAPBAKER_H
+
+#include <QCache>
+#include <QImage>
+#include <QVector>
+
+class Light;
+class ProjectedItem;
+
+// Bakes the lights of a scene into the textures of its walls. The lights
+// only depend on the position on the floor, so each column of texels of a
+// wall is shaded once by all lights at the position of the column, and the
+// wall then draws its pre-lit image with nothing blended over it.
+//
+// Every wall gets an image of its own, which for all walls of a big maze
+// would not fit in memory. Walls are baked when they come into view, and
+// the ones out of view for longest go back to their unlit texture once the
+// baked images outgrow the budget.
+class LightmapBaker
+{
+public:
+    LightmapBaker();
+
+    // drops everything baked with the previous lights
+    void setLights(const QVector<Light> &lights);
+
+    // gives all baked items their unlit texture back
+    void clear();
+
+    // gives item its pre-lit image unless it has it already, items that
+    // are not lit are left alone
+    void bake(ProjectedItem *item);
+
+private:
+    // undoes the baking of its item when the cache drops it
+    class Baked
+    {
+    public:
+        Baked(ProjectedItem *item) : m_item(item) {}
+        ~Baked();
+
+    private:
+        ProjectedItem *m_item;
+    };
+
+    QImage bakeWall(const ProjectedItem *item) const;
+
+    QVector<Light> m_lights;
+
+    // the cost of an image is its size in kilobytes
+    QCache<ProjectedItem *, Baked> m_baked;
+};
+
+#endif
@@ -36,8 +36,8 @@ DEPLOYMENT_PLUGIN += phonon_ds9 phonon_waveout
 }
 
 # Input
-HEADERS += entity.h mazescene.h scriptwidget.h
-SOURCES += main.cpp entity.cpp mazescene.cpp scriptwidget.cpp
+HEADERS += entity.h mazescene.h scriptwidget.h spanbuffer.h bsptree.h pvs.h segmentstore.h collisiongrid.h rectstore.h lockfree.h simulation.h framescheduler.h inputrecording.h worldrenderer.h atlas.h floorcaster.h lightmapbaker.h raycaster.h tilerasterizer.h
+SOURCES += main.cpp entity.cpp mazescene.cpp scriptwidget.cpp spanbuffer.cpp bsptree.cpp pvs.cpp segmentstore.cpp collisiongrid.cpp rectstore.cpp simulation.cpp framescheduler.cpp inputrecording.cpp worldrenderer.cpp atlas.cpp floorcaster.cpp lightmapbaker.cpp raycaster.cpp tilerasterizer.cpp
 
 # From modelviewer
 HEADERS += modelitem.h model.h
@@ -0,0 +1,104 @@
+#ifndef LOCKFREE_H
+#define LOCKFREE_H
+
+#include <QAtomicInt>
+
+// Hands the latest of a stream of values from one writer thread to one
+// reader thread without locking. The writer fills back() completely and
+// publishes it, the reader picks up the most recently published value in
+// update(), values published in between are skipped.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : m_back(0)
+        , m_front(1)
+        , m_middle(2)
+    {
+    }
+
+    // writer side
+    T &back() { return m_values[m_back]; }
+    void publish()
+    {
+        m_back = m_middle.fetchAndStoreOrdered(m_back | Fresh) & IndexMask;
+    }
+
+    // reader side, returns false if nothing was published since the last call
+    bool update()
+    {
+        if (!(int(m_middle) & Fresh))
+            return false;
+
+        m_front = m_middle.fetchAndStoreOrdered(m_front) & IndexMask;
+        return true;
+    }
+    const T &front() const { return m_values[m_front]; }
+
+private:
+    enum
+    {
+        IndexMask = 3,
+        Fresh = 4
+    };
+
+    T m_values[3];
+    int m_back;
+    int m_front;
+
+    // index of the value between the two sides, with Fresh set when the
+    // writer put it there
+    QAtomicInt m_middle;
+};
+
+// Fixed size queue passing values from one producer thread to one consumer
+// thread without locking. It holds up to Size - 1 values.
+template <typename T, int Size>
+class LockFreeQueue
+{
+public:
+    LockFreeQueue()
+        : m_head(0)
+        , m_tail(0)
+    {
+    }
+
+    // producer side, returns false if the queue is full
+    bool push(const T &value)
+    {
+        const int tail = m_tail;
+        const int next = (tail + 1) % Size;
+        if (next == m_head.fetchAndAddAcquire(0))
+            return false;
+
+        m_values[tail] = value;
+        m_tail.fetchAndStoreRelease(next);
+        return true;
+    }
+
+    // consumer side
+    bool isEmpty() const
+    {
+        return m_head == const_cast<QAtomicInt &>(m_tail).fetchAndAddAcquire(0);
+    }
+
+    // consumer side, returns false if the queue is empty
+    bool pop(T *value)
+    {
+        const int head = m_head;
+        if (head == m_tail.fetchAndAddAcquire(0))
+            return false;
+
+        *value = m_values[head];
+        m_head.fetchAndStoreRelease((head + 1) % Size);
+        return true;
+    }
+
+private:
+    T m_values[Size];
+    QAtomicInt m_head;
+    QAtomicInt m_tail;
+};
+
+#endif
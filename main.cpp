@@ -1,5 +1,35 @@
 #include <QtGui>
+#include "inputrecording.h"
 #include "mazescene.h"
+#include "simulation.h"
+
+// value following name in the arguments, e.g. "--record run.lwr"
+static QString argumentValue(const QStringList &arguments, const QString &name)
+{
+    const int index = arguments.indexOf(name);
+    if (index < 0 || index + 1 >= arguments.size())
+        return QString();
+    return arguments.at(index + 1);
+}
+
+// steps through a replay without showing anything and reports how long it took
+static int fastForward(MazeScene *scene, const InputRecording &recording)
+{
+    QElapsedTimer timer;
+    timer.start();
+    const int steps = scene->simulation()->fastForward();
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    const qint64 simulated = scene->simulation()->time();
+    QTextStream out(stdout);
+    out << recording.events().size() << " inputs, " << steps << " steps, "
+        << simulated << " simulated ms in " << elapsed / 1000000 << " ms" << endl;
+    if (steps > 0) {
+        out << "  " << QString::number(elapsed * 1e-6 / steps, 'f', 3) << " ms per step, "
+            << QString::number(simulated * 1e6 / qMax(qint64(1), elapsed), 'f', 1) << "x real time" << endl;
+    }
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
@@ -8,6 +38,26 @@ int main(int argc, char **argv)
     app.setApplicationName("LittleWorld");
     QPixmapCache::setCacheLimit(100 * 1024); // 100 MB
 
+    // --record writes all input to a file on exit, --replay plays such a
+    // file back in real time, or with --fast as fast as possible without
+    // a window
+    const QStringList arguments = app.arguments();
+    const QString recordFile = argumentValue(arguments, "--record");
+    const QString replayFile = argumentValue(arguments, "--replay");
+
+    InputRecording recording;
+    if (!replayFile.isEmpty()) {
+        if (!recording.load(replayFile)) {
+            qWarning("Could not read recording %s", qPrintable(replayFile));
+            return 1;
+        }
+    } else {
+        recording.setSeed(QDateTime::currentDateTime().toTime_t());
+    }
+
+    // scripts draw their random numbers on the GUI thread
+    qsrand(recording.seed());
+
     const char *map =
             "###&?##/#&##&##=########"
             "#                      #"
@@ -28,13 +78,53 @@ int main(int argc, char **argv)
 
     MazeScene *scene = new MazeScene(lights, map, 24, 10);
 
+    if (!replayFile.isEmpty()) {
+        scene->simulation()->replay(&recording);
+        if (arguments.contains("--fast"))
+            return fastForward(scene, recording);
+    } else if (!recordFile.isEmpty()) {
+        scene->simulation()->record(&recording);
+    }
+
     View view;
     view.resize(1024, 768);
     view.setScene(scene);
     view.show();
-    QGraphicsView *tmpview = scene->views().at(0);
-    tmpview->setViewport(new QGLWidget(QGLFormat(QGL::SampleBuffers)));
+
+    // --raycast draws with the software raycaster and --tiles with the
+    // items painted on all cores, both without OpenGL, R switches between
+    // the renderers at any time
+    if (arguments.contains("--raycast")) {
+        scene->setRenderMode(MazeScene::Raycasting);
+    } else if (arguments.contains("--tiles")) {
+        scene->setRenderMode(MazeScene::TileRasterizing);
+    } else {
+        QGraphicsView *tmpview = scene->views().at(0);
+        tmpview->setViewport(new QGLWidget(QGLFormat(QGL::SampleBuffers)));
+    }
     scene->updateRenderer();
+    scene->startSimulation();
+
+    // a second window looking down the big room from its far corner
+    View observer;
+    if (arguments.contains("--observer")) {
+        Camera camera;
+        camera.setPos(QPointF(22.5, 8.5));
+        camera.setYaw(225);
+        observer.setCamera(camera);
+        observer.resize(512, 384);
+        observer.setScene(scene);
+        observer.show();
+    }
+
+    const int result = app.exec();
+
+    if (!recordFile.isEmpty()) {
+        scene->simulation()->stop();
+        recording.setLength(scene->simulation()->time());
+        if (!recording.save(recordFile))
+            qWarning("Could not write recording %s", qPrintable(recordFile));
+    }
 
-    return app.exec();
+    return result;
 }
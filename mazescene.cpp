@@ -6,8 +6,9 @@
 #include <QPainter>
 #include <QPushButton>
 #include <QKeyEvent>
-#include <QTimer>
+#include <QStyleOptionGraphicsItem>
 #include <QVBoxLayout>
+#include <QtConcurrentMap>
 #if 0
 #include <QWebView>
 #endif
@@ -18,7 +19,10 @@
 
 #include <limits>
 
+#include "atlas.h"
 #include "scriptwidget.h"
+#include "simulation.h"
+#include "spanbuffer.h"
 #include "entity.h"
 #include "modelitem.h"
 
@@ -32,6 +36,8 @@
 
 View::View()
     : m_scene(0)
+    , m_viewpoint(0)
+    , m_ownCamera(false)
 {
 }
 
@@ -40,9 +46,121 @@ void View::setScene(MazeScene *scene)
     QGraphicsView::setScene(scene);
 
     m_scene = scene;
+    m_viewpoint = m_ownCamera ? m_scene->addViewpoint(m_camera) : 0;
     m_scene->viewResized(this);
 }
 
+void View::setCamera(const Camera &camera)
+{
+    m_camera = camera;
+
+    // the scene's items are placed for the scene's camera, so observers
+    // paint the items themselves from their own viewpoint
+    setOptimizationFlag(QGraphicsView::IndirectPainting);
+
+    if (m_scene && m_ownCamera)
+        m_scene->setViewpointCamera(m_viewpoint, camera);
+    else if (m_scene)
+        m_viewpoint = m_scene->addViewpoint(camera);
+
+    m_ownCamera = true;
+}
+
+// Observers draw their whole view here. drawItems() is only called when
+// items placed for the scene's camera reach the exposed part of the view,
+// which has nothing to do with what the observer's camera sees.
+void View::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    if (m_scene && m_ownCamera) {
+        m_scene->drawFloorAndCeiling(painter, rect, m_viewpoint);
+        m_scene->drawViewpoint(m_viewpoint, painter);
+    } else {
+        QGraphicsView::drawBackground(painter, rect);
+    }
+}
+
+void View::drawItems(QPainter *painter, int numItems, QGraphicsItem *items[],
+                     const QStyleOptionGraphicsItem options[])
+{
+    if (m_scene && m_ownCamera)
+        return;
+
+    if (const Raycaster *raycaster = m_scene ? m_scene->raycaster() : 0) {
+        // the raycaster drew the walls and the entities already, the
+        // widgets on walls show in the columns where their wall is in front
+        for (int i = 0; i < numItems; ++i) {
+            if (raycaster->drawsItem(items[i]))
+                continue;
+
+            QGraphicsItem *topLevel = items[i]->topLevelItem();
+            if (topLevel == items[i] || !raycaster->drawsItem(topLevel)) {
+                QGraphicsView::drawItems(painter, 1, items + i, options + i);
+                continue;
+            }
+
+            const QRegion columns = raycaster->wallColumns(topLevel);
+            if (columns.isEmpty())
+                continue;
+
+            // the columns are in device coordinates
+            painter->save();
+            const QTransform transform = painter->worldTransform();
+            painter->resetTransform();
+            painter->setClipRegion(columns, Qt::IntersectClip);
+            painter->setWorldTransform(transform);
+            QGraphicsView::drawItems(painter, 1, items + i, options + i);
+            painter->restore();
+        }
+        return;
+    }
+
+    if (TileRasterizer *rasterizer = m_scene ? m_scene->tileRasterizer() : 0) {
+        // runs of walls and entities are painted by the strips, the
+        // widgets in between by the GUI thread
+        int first = 0;
+        for (int i = 0; i < numItems; ++i) {
+            if (rasterizer->drawsItem(items[i]))
+                continue;
+
+            rasterizer->drawItems(painter, i - first, items + first, options + first);
+            QGraphicsView::drawItems(painter, 1, items + i, options + i);
+            first = i + 1;
+        }
+        rasterizer->drawItems(painter, numItems - first, items + first, options + first);
+        return;
+    }
+
+    WorldRenderer *renderer = m_scene ? m_scene->worldRenderer(painter) : 0;
+    if (!renderer) {
+        QGraphicsView::drawItems(painter, numItems, items, options);
+        return;
+    }
+
+    // Items come far to near. Runs of walls are drawn in one batch by the
+    // renderer, everything in between is painted as usual.
+    QVector<int> walls;
+    int first = 0;
+    for (int i = 0; i < numItems; ++i) {
+        const int wall = renderer->wallIndex(items[i]);
+        if (wall == WorldRenderer::NotAWall) {
+            if (!walls.isEmpty()) {
+                m_scene->drawWalls(painter, walls);
+                walls.clear();
+            }
+            continue;
+        }
+
+        if (first < i)
+            QGraphicsView::drawItems(painter, i - first, items + first, options + first);
+        first = i + 1;
+        walls << wall;
+    }
+
+    if (first < numItems)
+        QGraphicsView::drawItems(painter, numItems - first, items + first, options + first);
+    m_scene->drawWalls(painter, walls);
+}
+
 void View::resizeEvent(QResizeEvent *)
 {
     resetMatrix();
@@ -69,6 +187,17 @@ qreal Light::intensityAt(const QPointF &pos) const
         + linearIntensity / d;
 }
 
+int shadowAlpha(const QVector<Light> &lights, const QPointF &pos)
+{
+    const qreal constantIntensity = 80;
+
+    qreal l = constantIntensity;
+    foreach (const Light &light, lights)
+        l += light.intensityAt(pos);
+
+    return qMax(0, 255 - int(l));
+}
+
 QMatrix4x4 fromRotation(float angle, Qt::Axis axis)
 {
     QMatrix4x4 m;
@@ -159,25 +288,76 @@ void WalkingItem::updatePixmap()
         setPixmap(m_standingPixmap);
 }
 
+// walls without doors, widgets or other per cell behaviour, which can be
+// merged with their neighbours
+static bool isPlainWall(int type)
+{
+    return type == 0 || type == 1 || type == 2 || type == 6;
+}
+
+// endpoints of the wall on the given side of a cell, in the same winding
+// as PotentiallyVisibleSet::Side
+static void cellEdge(int x, int y, int side, QPointF *a, QPointF *b)
+{
+    switch (side) {
+    case PotentiallyVisibleSet::Top:
+        *a = QPointF(x, y);
+        *b = QPointF(x+1, y);
+        break;
+    case PotentiallyVisibleSet::Bottom:
+        *a = QPointF(x+1, y+1);
+        *b = QPointF(x, y+1);
+        break;
+    case PotentiallyVisibleSet::Left:
+        *a = QPointF(x, y+1);
+        *b = QPointF(x, y);
+        break;
+    default:
+        *a = QPointF(x+1, y);
+        *b = QPointF(x+1, y+1);
+        break;
+    }
+}
+
+static inline QRectF rectFromPoint(const QPointF &point, qreal size)
+{
+    return QRectF(point, point).adjusted(-size/2, -size/2, size/2, size/2);
+}
+
+static inline QRectF wallRect(const WallItem *item)
+{
+    return QRectF(item->a(), item->b()).adjusted(-0.01, -0.01, 0.01, 0.01);
+}
+
+// size of the collision rectangle of an entity, or of the camera
+static inline qreal colliderSize(const Entity *entity)
+{
+    return entity ? 0.7 : 0.25;
+}
+
+// entities are bucketed by their center, so collision queries look this
+// far around their rectangle to find every entity reaching into it
+static const qreal entityExtent = 0.4;
+
+// milliseconds per frame of the walking animation
+static const int walkingFrameTime = 300;
+
 MazeScene::MazeScene(const QVector<Light> &lights, const char *map, int width, int height)
     : m_lights(lights)
     , m_width(width)
     , m_height(height)
-    , m_walkingVelocity(0.0)
-    , m_strafingVelocity(0)
-    , m_turningSpeed(0)
-    , m_pitchSpeed(0)
-    , m_deltaYaw(0)
-    , m_deltaPitch(0)
-    , m_simulationTime(0)
-    , m_walkTime(0)
+    , m_simulation(0)
+    , m_doorValue(1)
+    , m_doorsOpening(false)
+    , m_animationTime(0)
+    , m_animationFrame(0)
+    , m_renderMode(ItemRendering)
 {
     m_camera.setPos(QPointF(1.5, 1.5));
     m_camera.setYaw(0.1);
-
-    m_doorAnimation = new QTimeLine(1000, this);
-    m_doorAnimation->setUpdateInterval(20);
-    connect(m_doorAnimation, SIGNAL(valueChanged(qreal)), this, SLOT(moveDoors(qreal)));
+    m_viewpoints << Viewpoint();
+    m_collisionGrid.setSize(width, height);
+    m_simulation = new Simulation(this, m_camera);
 
     QMap<char, int> types;
     types[' '] = -2;
@@ -194,43 +374,125 @@ MazeScene::MazeScene(const QVector<Light> &lights, const char *map, int width, i
     types['/'] = 9;
 
 
-    int type;
+    QVector<PotentiallyVisibleSet::CellKind> cells(width * height, PotentiallyVisibleSet::Solid);
+    QVector<int> edgeWalls(4 * width * height, -1);
+
+    // neighbour offsets for the top, bottom, left and right side of a cell
+    const int sideX[] = { 0, 0, -1, 1 };
+    const int sideY[] = { -1, 1, 0, 0 };
+
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            type = types[map[y*width+x]];
+            const int cell = y * width + x;
+
+            const int type = types[map[cell]];
+            if (type == -2)
+                cells[cell] = PotentiallyVisibleSet::Open;
+            else if (type == -1)
+                cells[cell] = PotentiallyVisibleSet::Door;
+            else if (type == 2)
+                cells[cell] = PotentiallyVisibleSet::Translucent;
+
             if (type >= 0)
                 continue;
 
-            type = types[map[(y-1)*width+x]];
-            if (type >= -1)
-                addWall(QPointF(x, y), QPointF(x+1, y), type);
-
-            type = types[map[(y+1)*width+x]];
-            if (type >= -1)
-                addWall(QPointF(x+1, y+1), QPointF(x, y+1), type);
+            for (int side = 0; side < 4; ++side) {
+                const int wallType = types[map[(y + sideY[side]) * width + x + sideX[side]]];
+                if (wallType < -1 || edgeWalls.at(4 * cell + side) >= 0)
+                    continue;
+
+                // extend plain walls along the row or column of open cells,
+                // so that a straight corridor wall takes fewer items
+                const int stepX = sideY[side] ? 1 : 0;
+                const int stepY = sideX[side] ? 1 : 0;
+                int length = 1;
+                if (type == -2 && isPlainWall(wallType)) {
+                    for (;;) {
+                        const int nx = x + length * stepX;
+                        const int ny = y + length * stepY;
+                        if (nx >= width || ny >= height || types[map[ny * width + nx]] != -2
+                            || types[map[(ny + sideY[side]) * width + nx + sideX[side]]] != wallType)
+                            break;
+                        ++length;
+                    }
+                }
 
-            type = types[map[y*width+x-1]];
-            if (type >= -1)
-                addWall(QPointF(x, y+1), QPointF(x, y), type);
+                QPointF a, b;
+                cellEdge(x, y, side, &a, &b);
+                if (length > 1) {
+                    QPointF lastA, lastB;
+                    cellEdge(x + (length - 1) * stepX, y + (length - 1) * stepY, side, &lastA, &lastB);
+                    if (b == lastA)
+                        b = lastB;
+                    else
+                        a = lastA;
+                }
 
-            type = types[map[y*width+x+1]];
-            if (type >= -1)
-                addWall(QPointF(x+1, y), QPointF(x+1, y+1), type);
+                addWall(a, b, wallType);
+                for (int i = 0; i < length; ++i)
+                    edgeWalls[4 * ((y + i * stepY) * width + x + i * stepX) + side] = m_walls.size() - 1;
+            }
         }
     }
 
-    QTimer *timer = new QTimer(this);
-    timer->setInterval(20);
-    timer->start();
-    connect(timer, SIGNAL(timeout()), this, SLOT(move()));
+    m_pvs.setMap(cells, edgeWalls, width, height);
+    m_raycaster.setMap(width, height, edgeWalls, m_walls);
+
+    QVector<QRectF> wallBounds;
+    QVector<CollisionGrid::WallKind> wallKinds;
+    foreach (WallItem *item, m_walls) {
+        wallBounds << wallRect(item);
+        if (item->type() == 6)
+            wallKinds << CollisionGrid::Passable;
+        else if (item->type() == -1)
+            wallKinds << CollisionGrid::Door;
+        else
+            wallKinds << CollisionGrid::Solid;
+    }
+    m_collisionGrid.setWalls(wallBounds, wallKinds);
+
+    QVector<BspTree::Segment> segments;
+    for (int i = 0; i < m_walls.size(); ++i) {
+        WallItem *item = m_walls.at(i);
+        BspTree::Segment segment;
+        segment.item = item;
+        segment.index = i;
+        segment.a = item->a();
+        segment.b = item->b();
+        segments << segment;
+    }
+    m_bspTree.build(segments);
+
+    m_itemSegments.clear();
+    m_itemSegments.resize(m_projectedItems.size());
+    for (int i = 0; i < m_bspTree.segmentCount(); ++i)
+        m_itemSegments[m_bspTree.segment(i).item->index()] << i;
 
-    m_time.start();
+    // everything starts out obscured, from now on only items that were
+    // visible in the previous frame need to be hidden again
+    foreach (ProjectedItem *item, m_projectedItems)
+        item->updateTransform(m_camera);
+
+    m_lightmapBaker.setLights(m_lights);
+    foreach (WallItem *item, m_widgetWalls)
+        item->updateLighting(m_lights);
     updateTransforms();
     updateRenderer();
 
 
 }
 
+MazeScene::~MazeScene()
+{
+    // the simulation thread uses the collision data of the scene
+    delete m_simulation;
+}
+
+void MazeScene::startSimulation()
+{
+    m_simulation->start();
+}
+
 void MazeScene::viewResized(QGraphicsView *view)
 {
 
@@ -242,7 +504,9 @@ void MazeScene::viewResized(QGraphicsView *view)
 void MazeScene::addProjectedItem(ProjectedItem *item)
 {
     addItem(item);
+    item->setIndex(m_projectedItems.size());
     m_projectedItems << item;
+    m_dynamicItems << item;
 }
 
 void MazeScene::addWall(const QPointF &a, const QPointF &b, int type)
@@ -264,12 +528,18 @@ void MazeScene::addWall(const QPointF &a, const QPointF &b, int type)
     }
 #endif
     item->setVisible(false);
-    addProjectedItem(item);
+    addItem(item);
+    item->setIndex(m_projectedItems.size());
+    m_projectedItems << item;
     m_walls << item;
+    m_tileRasterizer.addItem(item);
 
     if (type == -1)
         m_doors << item;
 
+    if (item->childItem())
+        m_widgetWalls << item;
+
     setSceneRect(-1, -1, 2, 2);
     if (item->childItem()) {
         QObject *widget = item->childItem()->widget()->children().value(0);
@@ -292,13 +562,6 @@ void MazeScene::loadFinished()
     }
 }
 
-static inline QTransform rotatingTransform(qreal angle)
-{
-    QTransform transform;
-    transform.rotate(angle);
-    return transform;
-}
-
 void Camera::setPitch(qreal pitch)
 {
     m_pitch = qBound(qreal(-30), pitch, qreal(30));
@@ -308,6 +571,8 @@ void Camera::setPitch(qreal pitch)
 void Camera::setYaw(qreal yaw)
 {
     m_yaw = yaw;
+    m_cosYaw = qCos(yaw * M_PI / 180);
+    m_sinYaw = qSin(yaw * M_PI / 180);
     m_matrixDirty = true;
 }
 
@@ -358,60 +623,116 @@ void Camera::updateMatrix() const
     m_viewProjectionMatrix = fromProjection(m_fov) * m_viewMatrix;
 }
 
-void MazeScene::drawBackground(QPainter *painter, const QRectF &)
+static QImage floorImage()
 {
     static QImage floor = QImage("floor.png").convertToFormat(QImage::Format_RGB32);
-    QBrush floorBrush(floor);
+    return floor;
+}
 
+static QImage ceilingImage()
+{
     static QImage ceiling = QImage("ceiling.png").convertToFormat(QImage::Format_RGB32);
-    QBrush ceilingBrush(ceiling);
+    return ceiling;
+}
+
+void planeMatrices(const QMatrix4x4 &m, QMatrix4x4 *floor, QMatrix4x4 *ceiling)
+{
+    *floor = m;
+    floor->translate(0, 0.5, 0);
+    *floor *= fromRotation(90, Qt::XAxis);
 
-    QTransform brushScale;
-    brushScale.scale(0.5 / floor.width(), 0.5 / floor.height());
-    floorBrush.setTransform(brushScale);
-    ceilingBrush.setTransform(brushScale);
+    *ceiling = m;
+    ceiling->translate(0, -0.5, 0);
+    *ceiling *= fromRotation(90, Qt::XAxis);
+}
 
-    const QRectF r(1, 1, m_width-2, m_height-2);
+// the floor and the ceiling plane of camera in scene coordinates
+static void planeTransforms(const Camera &camera, QTransform *floor, QTransform *ceiling)
+{
+    QMatrix4x4 floorMatrix;
+    QMatrix4x4 ceilingMatrix;
+    planeMatrices(camera.viewProjectionMatrix(), &floorMatrix, &ceilingMatrix);
 
-    QMatrix4x4 m = m_camera.viewProjectionMatrix();
+    *floor = floorMatrix.toTransform(0);
+    *ceiling = ceilingMatrix.toTransform(0);
+}
 
-    QMatrix4x4 floorMatrix = m;
-    floorMatrix.translate(0, 0.5, 0);
-    floorMatrix *= fromRotation(90, Qt::XAxis);
+void MazeScene::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    const QTransform device = painter->transform();
+    if (m_renderMode == Raycasting) {
+        m_raycaster.draw(painter, device.mapRect(rect).toAlignedRect(), m_camera, m_lights,
+                         m_entities, 1 - m_doorValue, floorImage(), ceilingImage());
+    } else if (m_renderMode == TileRasterizing) {
+        QTransform floor;
+        QTransform ceiling;
+        planeTransforms(m_camera, &floor, &ceiling);
+        m_tileRasterizer.drawFloorAndCeiling(painter, device.mapRect(rect).toAlignedRect(), floor * device,
+                                             ceiling * device, m_viewpoints.at(0).visibleWallLines,
+                                             floorImage(), ceilingImage());
+    } else if (WorldRenderer *renderer = worldRenderer(painter)) {
+        renderer->drawFloorAndCeiling(painter, m_camera);
+    } else {
+        drawFloorAndCeiling(painter, rect, 0);
+    }
+}
 
-    painter->save();
-    painter->setTransform(floorMatrix.toTransform(0), true);
-    painter->fillRect(r, floorBrush);
-    painter->restore();
+WorldRenderer *MazeScene::worldRenderer(QPainter *painter)
+{
+    return m_worldRenderer.isAvailable(painter) ? &m_worldRenderer : 0;
+}
 
-    QMatrix4x4 ceilingMatrix = m;
-    ceilingMatrix.translate(0, -0.5, 0);
-    ceilingMatrix *= fromRotation(90, Qt::XAxis);
+void MazeScene::setRenderMode(RenderMode mode)
+{
+    m_renderMode = mode;
 
-    painter->save();
-    painter->setTransform(ceilingMatrix.toTransform(0), true);
-    painter->fillRect(r, ceilingBrush);
-    painter->restore();
+    // the widgets on walls are placed differently for the raycaster, and
+    // only the OpenGL renderer does without baked walls
+    updateItemTransforms();
+    updateLighting();
+    update();
+}
+
+// goes through the render modes in the order of RenderMode
+void MazeScene::toggleRenderer()
+{
+    setRenderMode(RenderMode((m_renderMode + 1) % (TileRasterizing + 1)));
+}
+
+// walls are indices into m_walls, see WorldRenderer::wallIndex()
+void MazeScene::drawWalls(QPainter *painter, const QVector<int> &walls)
+{
+    m_worldRenderer.drawWalls(painter, m_camera, walls, 1 - m_doorValue);
+}
+
+void MazeScene::drawFloorAndCeiling(QPainter *painter, const QRectF &rect, int viewpoint)
+{
+    const Viewpoint &view = m_viewpoints.at(viewpoint);
+    QTransform floor;
+    QTransform ceiling;
+    planeTransforms(view.camera, &floor, &ceiling);
+
+    const QTransform device = painter->transform();
+    m_floorCaster.draw(painter, device.mapRect(rect).toAlignedRect(), floor * device, ceiling * device,
+                       view.visibleWallLines, floorImage(), ceilingImage());
 }
 
 void MazeScene::addEntity(Entity *entity)
 {
     addProjectedItem(entity);
+    m_tileRasterizer.addItem(entity);
+    m_raycaster.addItem(entity);
+    m_collisionGrid.moveEntity(m_entities.size(), entity->pos());
     m_entities << entity;
 }
 
-ProjectedItem::ProjectedItem(const QRectF &bounds, bool shadow, bool opaque)
+ProjectedItem::ProjectedItem(const QRectF &bounds, bool lit, bool opaque)
     : m_bounds(bounds)
-    , m_shadowItem(0)
+    , m_index(-1)
+    , m_lit(lit)
     , m_opaque(opaque)
-    , m_obscured(false)
+    , m_obscured(true)
 {
-    if (shadow) {
-        m_shadowItem = new QGraphicsRectItem(bounds, this);
-        m_shadowItem->setPen(Qt::NoPen);
-        m_shadowItem->setZValue(10);
-    }
-
     m_targetRect = m_bounds;
 }
 
@@ -429,12 +750,16 @@ void ProjectedItem::setPosition(const QPointF &a, const QPointF &b)
 {
     m_a = a;
     m_b = b;
+    m_modelMatrix = modelMatrixFor(a, b);
 }
 
-void ProjectedItem::setLightingEnabled(bool enable)
+QMatrix4x4 ProjectedItem::modelMatrixFor(const QPointF &a, const QPointF &b)
 {
-    if (m_shadowItem)
-        m_shadowItem->setVisible(enable);
+    const QPointF center = (a + b) / 2;
+    QMatrix4x4 m;
+    m.translate(center.x(), 0, center.y());
+    m *= fromRotation(-QLineF(b, a).angle(), Qt::YAxis);
+    return m;
 }
 
 class ProxyWidget : public QGraphicsProxyWidget
@@ -445,6 +770,20 @@ public:
     {
     }
 
+    // blended over the widget, in the proxy's coordinates
+    void setShade(const QBrush &shade)
+    {
+        m_shade = shade;
+        update();
+    }
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+    {
+        QGraphicsProxyWidget::paint(painter, option, widget);
+        if (m_shade.style() != Qt::NoBrush)
+            painter->fillRect(boundingRect(), m_shade);
+    }
+
 protected:
     QVariant itemChange(GraphicsItemChange change, const QVariant & value)
     {
@@ -455,31 +794,31 @@ protected:
         else
             return QGraphicsProxyWidget::itemChange(change, value);
     }
+
+private:
+    QBrush m_shade;
 };
 
 
 WallItem::WallItem(MazeScene *scene, const QPointF &a, const QPointF &b, int type)
-    : ProjectedItem(QRectF(-0.5, -0.5, 1.0, 1.0))
+    : ProjectedItem(QRectF(-0.5 * QLineF(a, b).length(), -0.5, QLineF(a, b).length(), 1.0))
     , m_type(type)
 {
     setPosition(a, b);
 
-    static QImage brown = QImage("brown.png").convertToFormat(QImage::Format_RGB32);
-    static QImage book = QImage("book.png").convertToFormat(QImage::Format_RGB32);
-    static QImage door = QImage("door.png").convertToFormat(QImage::Format_RGB32);
-
+    const Atlas &walls = AssetPack::instance().walls();
     switch (type) {
     case -1:
-        setImage(door);
+        setImage(walls.image(), walls.rect(AssetPack::DoorWall));
         break;
     case 1:
-        setImage(book);
+        setImage(walls.image(), walls.rect(AssetPack::BookWall));
         break;
     case 2:
         setOpaque(false);
         break;
     default:
-        setImage(brown);
+        setImage(walls.image(), walls.rect(AssetPack::BrownWall));
         break;
     }
 
@@ -614,40 +953,38 @@ void WallItem::childResized()
     // refresh cache size
     m_childItem->setCacheMode(QGraphicsItem::NoCache);
     m_childItem->setCacheMode(QGraphicsItem::ItemCoordinateCache);
+
+    updateChildShade();
 }
 
-void ProjectedItem::updateLighting(const QVector<Light> &lights, bool useConstantLight)
+void WallItem::updateLighting(const QVector<Light> &lights)
 {
-    if (!m_shadowItem)
+    if (!m_childItem)
         return;
 
-    if (useConstantLight) {
-        m_shadowItem->setBrush(QColor(0, 0, 0, 100));
-        return;
-    }
+    // one stop per scene unit, the falloff of the lights is far from
+    // linear over the length of a wall
+    const int stops = qMax(1, qRound(QLineF(a(), b()).length()));
+    m_shades.clear();
+    for (int i = 0; i <= stops; ++i)
+        m_shades << shadowAlpha(lights, b() + (a() - b()) * i / stops);
 
-    const qreal constantIntensity = 80;
-    qreal la = constantIntensity;
-    qreal lb = constantIntensity;
-    foreach (const Light &light, lights) {
-        la += light.intensityAt(m_b);
-        lb += light.intensityAt(m_a);
-    }
-
-    int va = qMax(0, 255 - int(la));
-    int vb = qMax(0, 255 - int(lb));
+    updateChildShade();
+}
 
-    if (va == vb) {
-        m_shadowItem->setBrush(QColor(0, 0, 0, va));
-    } else {
-        const QRectF rect = boundingRect();
-        QLinearGradient g(rect.topLeft(), rect.topRight());
+// the gradient runs along the wall, mapped into the scaled proxy
+void WallItem::updateChildShade()
+{
+    if (!m_childItem || m_shades.isEmpty())
+        return;
 
-        g.setColorAt(0, QColor(0, 0, 0, va));
-        g.setColorAt(1, QColor(0, 0, 0, vb));
+    const QRectF rect = boundingRect();
+    const QTransform toChild = m_childItem->transform().inverted();
+    QLinearGradient g(toChild.map(rect.topLeft()), toChild.map(rect.topRight()));
+    for (int i = 0; i < m_shades.size(); ++i)
+        g.setColorAt(qreal(i) / (m_shades.size() - 1), QColor(0, 0, 0, m_shades.at(i)));
 
-        m_shadowItem->setBrush(g);
-    }
+    static_cast<ProxyWidget *>(m_childItem)->setShade(g);
 }
 
 QRectF ProjectedItem::boundingRect() const
@@ -657,10 +994,30 @@ QRectF ProjectedItem::boundingRect() const
 
 void ProjectedItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
 {
-    if (!m_image.isNull()) {
+    // the lit image spans the whole item, doors show less of it as they
+    // slide open
+    if (!m_litImage.isNull()) {
+        const qreal shown = m_targetRect.width() / m_bounds.width();
+        painter->drawImage(m_targetRect, m_litImage, QRectF(0, 0, m_litImage.width() * shown, m_litImage.height()));
+        return;
+    }
+
+    if (m_image.isNull())
+        return;
+
+    const QRect source = sourceRect();
+    if (m_bounds.width() > 1) {
+        // merged walls repeat the texture once per scene unit, a part of an
+        // atlas can not be a brush so each unit is drawn on its own
+        for (qreal left = m_bounds.left(); left < m_bounds.right(); left += 1) {
+            const qreal width = qMin(qreal(1), m_bounds.right() - left);
+            painter->drawImage(QRectF(left, m_bounds.top(), width, m_bounds.height()), m_image,
+                               QRectF(source.x(), source.y(), source.width() * width, source.height()));
+        }
+    } else {
         QRectF target = m_targetRect.translated(0.5, 0.5);
-        QRectF source = QRectF(0, 0, m_image.width() * (1 - target.x()), m_image.height());
-        painter->drawImage(m_targetRect, m_image, source);
+        painter->drawImage(m_targetRect, m_image,
+                           QRectF(source.x(), source.y(), source.width() * (1 - target.x()), source.height()));
     }
 }
 
@@ -670,14 +1027,19 @@ void ProjectedItem::setAnimationTime(qreal time)
     QRectF rect = boundingRect();
     m_targetRect = QRectF(QPointF(rect.left() + rect.width() * time, rect.top()),
                           rect.bottomRight());
-    if (m_shadowItem)
-        m_shadowItem->setRect(m_targetRect);
     update();
 }
 
-void ProjectedItem::setImage(const QImage &image)
+void ProjectedItem::setImage(const QImage &image, const QRect &source)
 {
     m_image = image;
+    m_source = source;
+    update();
+}
+
+void ProjectedItem::setLitImage(const QImage &image)
+{
+    m_litImage = image;
     update();
 }
 
@@ -691,37 +1053,62 @@ bool ProjectedItem::isObscured() const
     return m_obscured;
 }
 
-void ProjectedItem::updateTransform(const Camera &camera)
+void ProjectedItem::setIndex(int index)
+{
+    m_index = index;
+}
+
+bool ProjectedItem::project(const Camera &camera, QTransform *transform, qreal *depth) const
+{
+    return projectPlacement(camera, m_a, m_b, m_modelMatrix, transform, depth);
+}
+
+void ProjectedItem::paintFrom(const Camera &, QPainter *painter)
 {
-    if (!m_obscured) {
-        QTransform rotation;
-        rotation *= QTransform().translate(-camera.pos().x(), -camera.pos().y());
-        rotation *= rotatingTransform(camera.yaw());
-        QPointF center = (m_a + m_b) / 2;
+    QStyleOptionGraphicsItem option;
+    paint(painter, &option, 0);
+}
 
-        QPointF ca = rotation.map(m_a);
-        QPointF cb = rotation.map(m_b);
+// project() for the item placed from a to b with the model matrix model
+bool ProjectedItem::projectPlacement(const Camera &camera, const QPointF &a, const QPointF &b,
+                                     const QMatrix4x4 &model, QTransform *transform, qreal *depth) const
+{
+    QPointF ca = camera.mapToCamera(a);
+    QPointF cb = camera.mapToCamera(b);
 
-        if (ca.y() > 0 || cb.y() > 0) {
-            QMatrix4x4 m = camera.viewProjectionMatrix();
-            m.translate(center.x(), 0, center.y());
-            m *= fromRotation(-QLineF(m_b, m_a).angle(), Qt::YAxis);
+    if (ca.y() <= 0 && cb.y() <= 0)
+        return false;
 
-            qreal zm = QLineF(camera.pos(), center).length();
+    const QMatrix4x4 m = camera.viewProjectionMatrix() * model;
+    *transform = m.toTransform(0);
 
-            setVisible(true);
-            setZValue(-zm);
-            setTransform(m.toTransform(0));
-            return;
-        }
+    const MazeScene *maze = static_cast<const MazeScene *>(scene());
+    *depth = maze ? maze->drawDepth(camera.pos(), this, a, b) : QLineF(camera.pos(), (a + b) / 2).length();
+    return true;
+}
+
+void ProjectedItem::updateTransform(const Camera &camera, const QTransform &screen)
+{
+    QTransform transform;
+    qreal depth;
+    if (!m_obscured && project(camera, &transform, &depth)) {
+        setVisible(true);
+        setZValue(-depth);
+        transform *= screen;
+
+        // an item that keeps its footprint does not need a repaint
+        if (transform != this->transform())
+            setTransform(transform);
+        return;
     }
 
     // hide the item by placing it far outside the scene
     // we could use setVisible() but that causes unnecessary
     // update to cahced items
-    QTransform transform;
+    transform.reset();
     transform.translate(-1000, -1000);
-    setTransform(transform);
+    if (transform != this->transform())
+        setTransform(transform);
 }
 
 
@@ -734,8 +1121,7 @@ void MazeScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 
     if (event->buttons() & Qt::RightButton) {
         QPointF delta(event->scenePos() - event->lastScenePos());
-        m_deltaYaw += delta.x() * 80;
-        m_deltaPitch -= delta.y() * 80;
+        post(SimulationInput(SimulationInput::Look, delta.x() * 80, -delta.y() * 80));
     }
 }
 
@@ -764,73 +1150,88 @@ bool MazeScene::handleKey(int key, bool pressed)
     if (focusItem())
         return false;
 
+    // drawing is not simulated
+    if (key == Qt::Key_R) {
+        if (pressed)
+            toggleRenderer();
+        return true;
+    }
+
+    SimulationInput input;
     switch (key) {
     case Qt::Key_Left:
     case Qt::Key_Q:
-        m_turningSpeed = (pressed ? -0.5 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Turn, pressed ? -0.5 : 0.0);
+        break;
     case Qt::Key_Right:
     case Qt::Key_E:
-        m_turningSpeed = (pressed ? 0.5 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Turn, pressed ? 0.5 : 0.0);
+        break;
     case Qt::Key_Down:
-        m_pitchSpeed = (pressed ? 0.5 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Pitch, pressed ? 0.5 : 0.0);
+        break;
     case Qt::Key_Up:
-        m_pitchSpeed = (pressed ? -0.5 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Pitch, pressed ? -0.5 : 0.0);
+        break;
     case Qt::Key_S:
-        m_walkingVelocity = (pressed ? -0.01 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Walk, pressed ? -0.01 : 0.0);
+        break;
     case Qt::Key_W:
-        m_walkingVelocity = (pressed ? 0.01 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Walk, pressed ? 0.01 : 0.0);
+        break;
     case Qt::Key_A:
-        m_strafingVelocity = (pressed ? -0.01 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Strafe, pressed ? -0.01 : 0.0);
+        break;
     case Qt::Key_D:
-        m_strafingVelocity = (pressed ? 0.01 : 0.0);
-        return true;
+        input = SimulationInput(SimulationInput::Strafe, pressed ? 0.01 : 0.0);
+        break;
+    default:
+        return false;
     }
 
-    return false;
+    post(input);
+    return true;
 }
 
-static inline QRectF rectFromPoint(const QPointF &point, qreal size)
+bool MazeScene::arePassagesOpen() const
 {
-    return QRectF(point, point).adjusted(-size/2, -size/2, size/2, size/2);
+    return m_simulation->arePassagesOpen();
 }
 
 bool MazeScene::blocked(const QPointF &pos, Entity *me) const
 {
-    const QRectF rect = rectFromPoint(pos, me ? 0.7 : 0.25);
+    const QRectF rect = rectFromPoint(pos, colliderSize(me));
+    const bool doorsOpen = arePassagesOpen();
 
-    foreach (WallItem *item, m_walls) {
-        if (item->type() == 6
-            || (item->type() == -1 && m_doorAnimation->state() != QTimeLine::Running
-               && m_doorAnimation->direction() == QTimeLine::Backward))
-            continue;
+    const QRect cells = m_collisionGrid.cellRange(rect.adjusted(-entityExtent, -entityExtent,
+                                                                entityExtent, entityExtent));
 
-        const QPointF a = item->a();
-        const QPointF b = item->b();
+    for (int y = cells.top(); y <= cells.bottom(); ++y) {
+        for (int x = cells.left(); x <= cells.right(); ++x) {
+            const int cell = m_collisionGrid.cellIndex(x, y);
 
-        QRectF wallRect = QRectF(a, b).adjusted(-0.01, -0.01, 0.01, 0.01);
+            for (int i = m_collisionGrid.wallBegin(cell); i < m_collisionGrid.wallEnd(cell); ++i) {
+                const WallItem *item = m_walls.at(m_collisionGrid.wall(i));
+                if (item->type() == 6 || (item->type() == -1 && doorsOpen))
+                    continue;
 
-        if (wallRect.intersects(rect))
-            return true;
-    }
+                if (wallRect(item).intersects(rect))
+                    return true;
+            }
 
-    foreach (Entity *entity, m_entities) {
-        if (entity == me)
-            continue;
-        QRectF entityRect = rectFromPoint(entity->pos(), 0.8);
+            for (int i = m_collisionGrid.firstEntity(cell); i >= 0; i = m_collisionGrid.nextEntity(i)) {
+                const Entity *entity = m_entities.at(i);
+                if (entity == me)
+                    continue;
 
-        if (entityRect.intersects(rect))
-            return true;
+                if (rectFromPoint(entity->pos(), 2 * entityExtent).intersects(rect))
+                    return true;
+            }
+        }
     }
 
     if (me) {
-        QRectF cameraRect = rectFromPoint(m_camera.pos(), 0.4);
+        QRectF cameraRect = rectFromPoint(m_simulation->camera().pos(), 0.4);
 
         if (cameraRect.intersects(rect))
             return true;
@@ -839,72 +1240,155 @@ bool MazeScene::blocked(const QPointF &pos, Entity *me) const
     return false;
 }
 
-bool MazeScene::tryMove(QPointF &pos, const QPointF &delta, Entity *entity) const
+// shortens a move of box along one axis so that it stops right before
+// obstacle, a box already overlapping the obstacle can not move at all
+static inline void clipSweep(const QRectF &box, const QRectF &obstacle, Qt::Orientation orientation,
+                             qreal *distance)
 {
-    const QPointF old = pos;
-
-    if (delta.x() != 0 && !blocked(pos + QPointF(delta.x(), 0), entity))
-        pos.setX(pos.x() + delta.x());
+    const QRectF o = obstacle.normalized();
+    const bool horizontal = orientation == Qt::Horizontal;
 
-    if (delta.y() != 0 && !blocked(pos + QPointF(0, delta.y()), entity))
-        pos.setY(pos.y() + delta.y());
+    const bool across = horizontal
+        ? box.top() < o.bottom() && o.top() < box.bottom()
+        : box.left() < o.right() && o.left() < box.right();
+    if (!across)
+        return;
 
-    return pos != old;
+    const qreal boxMin = horizontal ? box.left() : box.top();
+    const qreal boxMax = horizontal ? box.right() : box.bottom();
+    const qreal obstacleMin = horizontal ? o.left() : o.top();
+    const qreal obstacleMax = horizontal ? o.right() : o.bottom();
+
+    // keep the gap RectStore keeps, touching rectangles do not intersect
+    // but rounding might turn the contact into an overlap
+    if (boxMin < obstacleMax && obstacleMin < boxMax)
+        *distance = 0;
+    else if (*distance > 0 && obstacleMin >= boxMax)
+        *distance = qMin(*distance, qMax(qreal(0), obstacleMin - boxMax - RectStore::gap(obstacleMin)));
+    else if (*distance < 0 && obstacleMax <= boxMin)
+        *distance = qMax(*distance, qMin(qreal(0), obstacleMax - boxMin + RectStore::gap(obstacleMax)));
 }
 
-struct Span
+// how far the collision rectangle of me at pos can move along one axis,
+// up to distance
+qreal MazeScene::sweep(const QPointF &pos, Qt::Orientation orientation, qreal distance, Entity *me) const
 {
-    ProjectedItem *item;
+    const QRectF box = rectFromPoint(pos, colliderSize(me));
+    const bool doorsOpen = arePassagesOpen();
 
-    // screen coordinates
-    float sx1;
-    float sx2;
+    QRectF swept = box;
+    if (orientation == Qt::Horizontal)
+        swept.adjust(qMin(distance, qreal(0)), 0, qMax(distance, qreal(0)), 0);
+    else
+        swept.adjust(0, qMin(distance, qreal(0)), 0, qMax(distance, qreal(0)));
 
-    float cy;
-};
+    distance = m_collisionGrid.sweepWalls(box, orientation, distance,
+                                          m_collisionGrid.cellRange(swept), !doorsOpen);
 
-int split(QList<Span> &list, float x)
-{
-    for (int i = 0; i < list.size(); ++i) {
-        Span &span = list[i];
-        if (span.sx2 == x)
-            return i+1;
+    const QRect cells = m_collisionGrid.cellRange(swept.adjusted(-entityExtent, -entityExtent,
+                                                                 entityExtent, entityExtent));
 
-        if (span.sx1 <= x && span.sx2 > x) {
-            Span split = span;
-            span.sx2 = x;
-            split.sx1 = x;
-            list.insert(i+1, split);
-            return i+1;
+    for (int y = cells.top(); y <= cells.bottom() && distance != 0; ++y) {
+        for (int x = cells.left(); x <= cells.right() && distance != 0; ++x) {
+            const int cell = m_collisionGrid.cellIndex(x, y);
+
+            for (int i = m_collisionGrid.firstEntity(cell); i >= 0; i = m_collisionGrid.nextEntity(i)) {
+                const Entity *entity = m_entities.at(i);
+                if (entity != me)
+                    clipSweep(box, rectFromPoint(entity->pos(), 2 * entityExtent), orientation, &distance);
+            }
         }
     }
-    return -1;
+
+    if (me)
+        clipSweep(box, rectFromPoint(m_simulation->camera().pos(), 0.4), orientation, &distance);
+
+    return distance;
 }
 
-bool insertSpan(QList<Span> &list, const Span &span, bool checkOnly)
+// Moves pos by up to delta, one axis after the other, stopping each axis
+// at the first obstacle in the way. Walking into a wall at an angle slides
+// along it, and the delta may be arbitrarily large.
+bool MazeScene::tryMove(QPointF &pos, const QPointF &delta, Entity *entity) const
 {
-    int left = split(list, span.sx1);
-    int right = split(list, span.sx2);
+    const QPointF old = pos;
 
-    bool visible = false;
-    for (int i = left; i < right; ++i) {
-        Span &s = list[i];
-        if (s.cy > span.cy) {
-            visible = true;
-            if (!checkOnly) {
-                s.item = span.item;
-                s.cy = span.cy;
-            }
+    if (delta.x() != 0)
+        pos.setX(pos.x() + sweep(pos, Qt::Horizontal, delta.x(), entity));
+
+    if (delta.y() != 0)
+        pos.setY(pos.y() + sweep(pos, Qt::Vertical, delta.y(), entity));
+
+    return pos != old;
+}
+
+// Entities are resolved in order, each against a snapshot of all entity
+// rectangles that follows the entities already moved, so the result is
+// the same as calling tryMove() for one after the other. The snapshot and
+// the walls are stored as float arrays, and each row of cells around a
+// move is tested as one contiguous run.
+void MazeScene::tryMoveAll(QVector<qreal> &x, QVector<qreal> &y,
+                           const QVector<qreal> &dx, const QVector<qreal> &dy)
+{
+    const int count = m_entities.size();
+    const bool doorsOpen = arePassagesOpen();
+    const QRectF cameraRect = rectFromPoint(m_simulation->camera().pos(), 0.4);
+
+    QVector<QRectF> rects(count);
+    qreal reach = 0;
+    for (int i = 0; i < count; ++i) {
+        rects[i] = rectFromPoint(QPointF(x.at(i), y.at(i)), 2 * entityExtent);
+        reach = qMax(reach, qMax(qAbs(dx.at(i)), qAbs(dy.at(i))));
+    }
+    m_collisionGrid.beginBatch(rects);
+
+    // the snapshot keeps entities in the cells they started in
+    const qreal extent = entityExtent + reach;
+
+    for (int i = 0; i < count; ++i) {
+        if (dx.at(i) == 0 && dy.at(i) == 0)
+            continue;
+
+        const qreal size = colliderSize(m_entities.at(i));
+        QPointF pos(x.at(i), y.at(i));
+
+        for (int axis = 0; axis < 2; ++axis) {
+            const Qt::Orientation orientation = axis == 0 ? Qt::Horizontal : Qt::Vertical;
+            qreal distance = axis == 0 ? dx.at(i) : dy.at(i);
+            if (distance == 0)
+                continue;
+
+            const QRectF box = rectFromPoint(pos, size);
+            QRectF swept = box;
+            if (orientation == Qt::Horizontal)
+                swept.adjust(qMin(distance, qreal(0)), 0, qMax(distance, qreal(0)), 0);
+            else
+                swept.adjust(0, qMin(distance, qreal(0)), 0, qMax(distance, qreal(0)));
+
+            distance = m_collisionGrid.sweepWalls(box, orientation, distance,
+                                                  m_collisionGrid.cellRange(swept), !doorsOpen);
+
+            const QRect cells = m_collisionGrid.cellRange(swept.adjusted(-extent, -extent, extent, extent));
+            distance = m_collisionGrid.sweepBatchEntities(box, orientation, distance, cells, i);
+
+            clipSweep(box, cameraRect, orientation, &distance);
+
+            if (orientation == Qt::Horizontal)
+                pos.setX(pos.x() + distance);
+            else
+                pos.setY(pos.y() + distance);
         }
+
+        x[i] = pos.x();
+        y[i] = pos.y();
+        m_collisionGrid.setBatchEntity(i, rectFromPoint(pos, 2 * entityExtent));
     }
-    return visible;
 }
 
-bool insertProjectedItem(QList<Span> &list, ProjectedItem *item, const QTransform &cameraTransform, bool checkOnly)
+// a and b are in camera space, see Camera::mapToCamera()
+bool insertSegment(SpanBuffer &buffer, ProjectedItem *item, int index, QPointF ca, QPointF cb,
+                   bool checkOnly)
 {
-    QPointF ca = cameraTransform.map(item->a());
-    QPointF cb = cameraTransform.map(item->b());
-
     if (ca.y() <= 0 && cb.y() <= 0)
         return false;
 
@@ -921,54 +1405,487 @@ bool insertProjectedItem(QList<Span> &list, ProjectedItem *item, const QTransfor
 
     Span span;
     span.item = item;
+    span.index = index;
     span.sx1 = ca.x() / ca.y();
     span.sx2 = cb.x() / cb.y();
-    span.cy = (ca.y() + cb.y()) * 0.5f;
+    span.maxCy = qMax(ca.y(), cb.y());
+
+    // the inverse depth is linear along the span on screen
+    span.dw = (1 / cb.y() - 1 / ca.y()) / (span.sx2 - span.sx1);
+    span.w0 = 1 / ca.y() - span.dw * span.sx1;
 
     if (span.sx1 >= span.sx2)
         qSwap(span.sx1, span.sx2);
 
-    return insertSpan(list, span, checkOnly);
+    return buffer.insert(span, checkOnly);
 }
 
-void MazeScene::updateTransforms()
+// horizontal extent of the view in camera space, the view always shows
+// four scene units horizontally (see View::resizeEvent) and pitching the
+// camera widens what ends up near the screen corners
+static qreal visibleHalfWidth(const Camera &camera)
 {
-    Span span;
-    span.item = 0;
-    span.sx1 = -std::numeric_limits<float>::infinity();
-    span.sx2 =  std::numeric_limits<float>::infinity();
-    span.cy = std::numeric_limits<float>::infinity();
-
-    QList<Span> visibleList;
-    visibleList << span;
-
-    QTransform rotation;
-    rotation *= QTransform().translate(-m_camera.pos().x(), -m_camera.pos().y());
-    rotation *= rotatingTransform(m_camera.yaw());
-
-    // first add all opaque items
-    foreach (ProjectedItem *item, m_projectedItems) {
-        if (item->isOpaque()) {
-            item->setObscured(true);
-            insertProjectedItem(visibleList, item, rotation, false);
+    const qreal focalLength = qAbs(qCos(camera.fov() / 2) / qSin(camera.fov() / 2));
+    return 1.2 * 2 / focalLength / qCos(camera.pitch() * M_PI / 180);
+}
+
+// the part of the wall from a to b that span shows, ca and cb are a and b
+// in camera space
+static QLineF spanLine(const Span &span, const QPointF &a, const QPointF &b, const QPointF &ca, const QPointF &cb,
+                       qreal halfWidth)
+{
+    const qreal sx[] = {
+        qBound(-halfWidth, qreal(span.sx1), halfWidth),
+        qBound(-halfWidth, qreal(span.sx2), halfWidth)
+    };
+
+    QPointF points[2];
+    for (int i = 0; i < 2; ++i) {
+        // where the ray through sx meets the wall
+        const qreal denominator = (cb.x() - ca.x()) - sx[i] * (cb.y() - ca.y());
+        const qreal t = qFuzzyIsNull(denominator) ? 0 : (sx[i] * ca.y() - ca.x()) / denominator;
+        points[i] = a + (b - a) * qBound(qreal(0), t, qreal(1));
+    }
+    return QLineF(points[0], points[1]);
+}
+
+class VisibilityVisitor : public BspTree::Visitor
+{
+public:
+    VisibilityVisitor(const BspTree *tree, SpanBuffer *spans, const Camera &camera,
+                      const SegmentStore *cameraWalls, qreal halfWidth, const uchar *inView,
+                      const QBitArray *potentiallyVisible, bool frontToBack)
+        : m_tree(tree)
+        , m_spans(spans)
+        , m_camera(camera)
+        , m_cameraWalls(cameraWalls)
+        , m_halfWidth(halfWidth)
+        , m_inView(inView)
+        , m_potentiallyVisible(potentiallyVisible)
+        , m_frontToBack(frontToBack)
+    {
+    }
+
+    bool acceptNode(const QRectF &bounds)
+    {
+        // skip subtrees entirely behind the camera or beside the view
+        const QPointF corners[] = { bounds.topLeft(), bounds.topRight(),
+                                    bounds.bottomLeft(), bounds.bottomRight() };
+        int behind = 0;
+        int left = 0;
+        int right = 0;
+        qreal minX = 0;
+        qreal maxX = 0;
+        qreal minY = 0;
+        for (int i = 0; i < 4; ++i) {
+            const QPointF p = m_camera.mapToCamera(corners[i]);
+            behind += p.y() <= 0;
+            left += p.x() + m_halfWidth * p.y() < 0;
+            right += p.x() - m_halfWidth * p.y() > 0;
+
+            if (p.y() > 0) {
+                const qreal sx = p.x() / p.y();
+                minX = i ? qMin(minX, sx) : sx;
+                maxX = i ? qMax(maxX, sx) : sx;
+                minY = i ? qMin(minY, p.y()) : p.y();
+            }
+        }
+
+        if (behind == 4 || left == 4 || right == 4)
+            return false;
+
+        // and subtrees hidden behind walls that are already inserted
+        return behind > 0 || !m_spans->isOccluded(minX, maxX, minY);
+    }
+
+    bool visitSegments(int first, int count)
+    {
+        for (int i = first; i < first + count; ++i) {
+            if (!m_inView[i])
+                continue;
+
+            const BspTree::Segment &segment = m_tree->segment(i);
+            if (m_potentiallyVisible && !m_potentiallyVisible->testBit(segment.index))
+                continue;
+
+            if (segment.item->isOpaque())
+                insertSegment(*m_spans, segment.item, i, m_cameraWalls->a(i), m_cameraWalls->b(i), false);
+            else
+                m_nonOpaqueSegments << i;
+        }
+
+        // when walking strictly front to back nothing else can be visible
+        // once the screen is covered
+        return !m_frontToBack || !m_spans->isScreenCovered();
+    }
+
+    // indices into the tree of the non-opaque segments that were visited
+    const QVector<int> &nonOpaqueSegments() const
+    {
+        return m_nonOpaqueSegments;
+    }
+
+private:
+    const BspTree *m_tree;
+    SpanBuffer *m_spans;
+    const Camera &m_camera;
+    const SegmentStore *m_cameraWalls;
+    qreal m_halfWidth;
+    const uchar *m_inView;
+    const QBitArray *m_potentiallyVisible;
+    bool m_frontToBack;
+    QVector<int> m_nonOpaqueSegments;
+};
+
+bool MazeScene::areDoorsOpen() const
+{
+    foreach (WallItem *door, m_doors) {
+        if (!door->isOpaque())
+            return true;
+    }
+    return false;
+}
+
+Viewpoint::Viewpoint()
+    : potentiallyVisibleValid(false)
+    , pvsCell(-1)
+    , pvsDoorsOpen(false)
+    , visibilityValid(false)
+    , visibilityDoorsOpen(false)
+{
+}
+
+// returns the walls that can be seen from the viewpoint's cell, or 0 if
+// the camera is outside of the open part of the map
+const QBitArray *MazeScene::potentiallyVisibleWalls(Viewpoint &viewpoint, bool doorsOpen)
+{
+    const QPointF pos = viewpoint.camera.pos();
+    const int x = qFloor(pos.x());
+    const int y = qFloor(pos.y());
+    const int cell = (x >= 0 && y >= 0 && x < m_width && y < m_height) ? y * m_width + x : -1;
+
+    if (cell != viewpoint.pvsCell || doorsOpen != viewpoint.pvsDoorsOpen) {
+        viewpoint.pvsCell = cell;
+        viewpoint.pvsDoorsOpen = doorsOpen;
+
+        const PotentiallyVisibleSet::Cell *set = m_pvs.cell(x, y);
+        viewpoint.potentiallyVisibleValid = set != 0;
+        if (set) {
+            viewpoint.potentiallyVisible.fill(false, m_walls.size());
+            foreach (int wall, set->walls)
+                viewpoint.potentiallyVisible.setBit(wall);
+            if (doorsOpen) {
+                foreach (int wall, set->gated)
+                    viewpoint.potentiallyVisible.setBit(wall);
+            }
         }
     }
 
+    return viewpoint.potentiallyVisibleValid ? &viewpoint.potentiallyVisible : 0;
+}
+
+void MazeScene::setCamera(const Camera &camera)
+{
+    m_camera = camera;
+
+    SimulationInput input(SimulationInput::SetCamera, camera.pos().x(), camera.pos().y());
+    input.yaw = camera.yaw();
+    input.pitch = camera.pitch();
+    post(input);
+}
+
+int MazeScene::addViewpoint(const Camera &camera)
+{
+    Viewpoint viewpoint;
+    viewpoint.camera = camera;
+    m_viewpoints << viewpoint;
+
+    updateTransforms(false);
+    return m_viewpoints.size() - 1;
+}
+
+void MazeScene::setViewpointCamera(int index, const Camera &camera)
+{
+    m_viewpoints[index].camera = camera;
+    updateTransforms(false);
+}
+
+// runs the visibility pass of one viewpoint on a pool thread
+class VisibilityTask
+{
+public:
+    typedef void result_type;
+
+    VisibilityTask(const MazeScene *scene, bool doorsOpen)
+        : m_scene(scene)
+        , m_doorsOpen(doorsOpen)
+    {
+    }
+
+    void operator()(Viewpoint &viewpoint) const
+    {
+        m_scene->computeVisibility(viewpoint, m_doorsOpen);
+    }
+
+private:
+    const MazeScene *m_scene;
+    bool m_doorsOpen;
+};
+
+void MazeScene::updateVisibility()
+{
+    m_viewpoints[0].camera = m_camera;
+
+    m_dynamicEndpoints.resize(m_dynamicItems.size());
+    for (int i = 0; i < m_dynamicItems.size(); ++i)
+        m_dynamicEndpoints.set(i, m_dynamicItems.at(i)->a(), m_dynamicItems.at(i)->b());
+
+    // the potentially visible sets are filled in lazily, so look them up
+    // before the passes run in parallel
+    const bool doorsOpen = areDoorsOpen();
+    for (int i = 0; i < m_viewpoints.size(); ++i)
+        potentiallyVisibleWalls(m_viewpoints[i], doorsOpen);
+
+    if (m_viewpoints.size() > 1)
+        QtConcurrent::blockingMap(m_viewpoints, VisibilityTask(this, doorsOpen));
+    else
+        computeVisibility(m_viewpoints[0], doorsOpen);
+
+    // the scene's items follow the scene's own camera
+    Viewpoint &viewpoint = m_viewpoints[0];
+    foreach (ProjectedItem *item, viewpoint.previousVisibleItems)
+        item->setObscured(true);
+    foreach (ProjectedItem *item, viewpoint.visibleItems)
+        item->setObscured(false);
+}
+
+// Only reads the shared world, everything it writes lives in viewpoint,
+// so passes for different viewpoints can run at the same time.
+void MazeScene::computeVisibility(Viewpoint &viewpoint, bool doorsOpen) const
+{
+    const Camera &camera = viewpoint.camera;
+    const qreal halfWidth = visibleHalfWidth(camera);
+
+    SpanBuffer visibleSpans;
+    visibleSpans.setScreenRange(-halfWidth, halfWidth);
+
+    // map all endpoints into camera space in one batch, everything below
+    // reads them from there, then reject everything outside of the
+    // horizontal field of view in one go
+    m_bspTree.endpoints().mapToCamera(camera.pos(), camera.yaw(), &viewpoint.cameraWalls);
+    viewpoint.wallsInView.resize(m_bspTree.segmentCount());
+    viewpoint.cameraWalls.cullToWedge(halfWidth, viewpoint.wallsInView.data());
+
+    m_dynamicEndpoints.mapToCamera(camera.pos(), camera.yaw(), &viewpoint.cameraDynamic);
+    viewpoint.dynamicInView.resize(m_dynamicItems.size());
+    viewpoint.cameraDynamic.cullToWedge(halfWidth, viewpoint.dynamicInView.data());
+
+    const QBitArray *potentiallyVisible =
+        viewpoint.potentiallyVisibleValid ? &viewpoint.potentiallyVisible : 0;
+
+    // If the camera barely moved since the previous frame and no door
+    // changed, the walls visible back then are inserted first. They cover
+    // most of the screen already, so the occlusion test during the tree
+    // walk only lets through the parts near their edges and near the
+    // border of the view. Walking is no longer strictly front to back
+    // then, so the walk can not stop once the screen is covered.
+    const bool incremental = viewpoint.visibilityValid
+        && doorsOpen == viewpoint.visibilityDoorsOpen
+        && QLineF(viewpoint.visibilityCamera.pos(), camera.pos()).length() < 0.25
+        && qAbs(viewpoint.visibilityCamera.yaw() - camera.yaw()) < 5;
+
+    if (incremental) {
+        foreach (int index, viewpoint.visibleSegments) {
+            const BspTree::Segment &segment = m_bspTree.segment(index);
+            if (!viewpoint.wallsInView.at(index) || !segment.item->isOpaque())
+                continue;
+            if (potentiallyVisible && !potentiallyVisible->testBit(segment.index))
+                continue;
+            insertSegment(visibleSpans, segment.item, index,
+                          viewpoint.cameraWalls.a(index), viewpoint.cameraWalls.b(index), false);
+        }
+    }
+
+    viewpoint.visibilityValid = true;
+    viewpoint.visibilityCamera = camera;
+    viewpoint.visibilityDoorsOpen = doorsOpen;
+
+    // first add all opaque items, walls front to back
+    VisibilityVisitor visitor(&m_bspTree, &visibleSpans, camera, &viewpoint.cameraWalls, halfWidth,
+                              viewpoint.wallsInView.constData(), potentiallyVisible, !incremental);
+    m_bspTree.traverse(camera.pos(), &visitor);
+
+    for (int i = 0; i < m_dynamicItems.size(); ++i) {
+        ProjectedItem *item = m_dynamicItems.at(i);
+        if (viewpoint.dynamicInView.at(i) && item->isOpaque())
+            insertSegment(visibleSpans, item, -1, viewpoint.cameraDynamic.a(i), viewpoint.cameraDynamic.b(i), false);
+    }
+
     // mark visible opaque items
-    for (int i = 0; i < visibleList.size(); ++i)
-        if (visibleList.at(i).item)
-            visibleList.at(i).item->setObscured(false);
+    QBitArray &visible = viewpoint.visible;
+    visible.fill(false, m_projectedItems.size());
+    qSwap(viewpoint.visibleItems, viewpoint.previousVisibleItems);
+    viewpoint.visibleItems.clear();
+    viewpoint.visibleSegments.clear();
+    viewpoint.visibleWallLines.clear();
+    foreach (const Span &span, visibleSpans.spans()) {
+        if (span.index >= 0 && (viewpoint.visibleSegments.isEmpty() || viewpoint.visibleSegments.last() != span.index))
+            viewpoint.visibleSegments << span.index;
+
+        if (span.index >= 0) {
+            const BspTree::Segment &segment = m_bspTree.segment(span.index);
+            viewpoint.visibleWallLines << spanLine(span, segment.a, segment.b, viewpoint.cameraWalls.a(span.index),
+                                                   viewpoint.cameraWalls.b(span.index), halfWidth);
+        } else if (span.item) {
+            viewpoint.visibleWallLines << spanLine(span, span.item->a(), span.item->b(),
+                                                   camera.mapToCamera(span.item->a()),
+                                                   camera.mapToCamera(span.item->b()), halfWidth);
+        }
+
+        if (span.item && !visible.testBit(span.item->index())) {
+            visible.setBit(span.item->index());
+            viewpoint.visibleItems << span.item;
+        }
+    }
 
     // now add all non-opaque items
-    foreach (ProjectedItem *item, m_projectedItems) {
-        if (!item->isOpaque())
-            item->setObscured(!insertProjectedItem(visibleList, item, rotation, true));
+    foreach (int index, visitor.nonOpaqueSegments()) {
+        ProjectedItem *item = m_bspTree.segment(index).item;
+        if (!visible.testBit(item->index())
+            && insertSegment(visibleSpans, item, -1, viewpoint.cameraWalls.a(index), viewpoint.cameraWalls.b(index), true)) {
+            visible.setBit(item->index());
+            viewpoint.visibleItems << item;
+        }
     }
 
-    foreach (ProjectedItem *item, m_projectedItems)
-        item->updateTransform(m_camera);
+    for (int i = 0; i < m_dynamicItems.size(); ++i) {
+        ProjectedItem *item = m_dynamicItems.at(i);
+        if (!viewpoint.dynamicInView.at(i) || item->isOpaque() || visible.testBit(item->index()))
+            continue;
 
-    foreach (WallItem *item, m_walls) {
+        if (insertSegment(visibleSpans, item, -1, viewpoint.cameraDynamic.a(i), viewpoint.cameraDynamic.b(i), true)) {
+            visible.setBit(item->index());
+            viewpoint.visibleItems << item;
+        }
+    }
+
+    // the scene's own camera places the items themselves, see
+    // updateItemTransforms(), other viewpoints keep their own transforms
+    if (&viewpoint == &m_viewpoints.at(0))
+        return;
+
+    viewpoint.transforms.resize(viewpoint.visibleItems.size());
+    viewpoint.depths.resize(viewpoint.visibleItems.size());
+    for (int i = 0; i < viewpoint.visibleItems.size(); ++i)
+        viewpoint.visibleItems.at(i)->project(camera, &viewpoint.transforms[i], &viewpoint.depths[i]);
+}
+
+// Walls come in the order the BSP tree visits them in, which is exact far
+// to near however long they are. A wall the tree had to cut goes by its
+// farthest piece, nothing on the camera's side of a wall is hidden by it.
+// Everything else is placed among the walls by its center, items between
+// the same walls by their distance.
+qreal MazeScene::drawDepth(const QPointF &pos, const ProjectedItem *item, const QPointF &a, const QPointF &b) const
+{
+    if (item->index() < m_itemSegments.size() && !m_itemSegments.at(item->index()).isEmpty()) {
+        int rank = 0;
+        foreach (int segment, m_itemSegments.at(item->index()))
+            rank = qMax(rank, m_bspTree.segmentRank(pos, segment));
+        return 2 * rank;
+    }
+
+    const QPointF center = (a + b) / 2;
+    const qreal distance = QLineF(pos, center).length();
+    return 2 * m_bspTree.pointRank(pos, center) - 1.5 + distance / (1 + distance);
+}
+
+void MazeScene::updateItemTransforms()
+{
+    const Viewpoint &viewpoint = m_viewpoints.at(0);
+
+    Camera camera;
+    QTransform screen;
+    itemProjection(&camera, &screen);
+
+    // items that were visible in the previous frame have to be hidden,
+    // culled items that stay hidden never get a transform built
+    foreach (ProjectedItem *item, viewpoint.previousVisibleItems) {
+        if (item->isObscured())
+            item->updateTransform(camera, screen);
+    }
+
+    foreach (ProjectedItem *item, viewpoint.visibleItems)
+        item->updateTransform(camera, screen);
+}
+
+// The raycaster keeps its rays level and moves the horizon for the pitch.
+// The items it draws in their place, entities and the widgets on walls,
+// are projected the same way, or the areas their moves repaint would miss
+// what it drew.
+void MazeScene::itemProjection(Camera *camera, QTransform *screen) const
+{
+    *camera = m_camera;
+    *screen = QTransform();
+    if (m_renderMode == Raycasting && !qFuzzyIsNull(m_camera.pitch())) {
+        camera->setPitch(0);
+        *screen = QTransform::fromTranslate(0, Raycaster::horizonShift(m_camera));
+    }
+}
+
+// Observers see walls of their own, they are baked as well. The OpenGL
+// renderer lights the walls of the scene's own camera per vertex, images
+// baked for it would only take up memory.
+void MazeScene::updateLighting()
+{
+    const bool openGL = drawsWallsWithOpenGL();
+    if (openGL && m_viewpoints.size() == 1) {
+        m_lightmapBaker.clear();
+        return;
+    }
+
+    for (int i = openGL ? 1 : 0; i < m_viewpoints.size(); ++i) {
+        foreach (ProjectedItem *item, m_viewpoints.at(i).visibleItems)
+            m_lightmapBaker.bake(item);
+    }
+}
+
+bool MazeScene::drawsWallsWithOpenGL() const
+{
+    QGraphicsView *view = views().isEmpty() ? 0 : views().at(0);
+    return m_renderMode == ItemRendering && view && view->viewport()->inherits("QGLWidget")
+        && !m_worldRenderer.hasFailed();
+}
+
+// paints the visible items of an observer viewpoint far to near
+void MazeScene::drawViewpoint(int index, QPainter *painter)
+{
+    const Viewpoint &viewpoint = m_viewpoints.at(index);
+
+    QVector<QPair<qreal, int> > order;
+    for (int i = 0; i < viewpoint.visibleItems.size(); ++i)
+        order << qMakePair(-viewpoint.depths.at(i), i);
+    qSort(order);
+
+    for (int i = 0; i < order.size(); ++i) {
+        const int item = order.at(i).second;
+        ProjectedItem *projectedItem = viewpoint.visibleItems.at(item);
+
+        painter->save();
+        painter->setTransform(viewpoint.transforms.at(item), true);
+        projectedItem->paintFrom(viewpoint.camera, painter);
+        painter->restore();
+    }
+}
+
+// cameraMoved tells whether the scene's own camera moved, which changes
+// everything in its views
+void MazeScene::updateTransforms(bool cameraMoved)
+{
+    updateVisibility();
+    updateItemTransforms();
+    updateLighting();
+
+    foreach (WallItem *item, m_widgetWalls) {
         if (item->isVisible() && !item->isObscured()) {
             // embed recursive scene
             if (QGraphicsProxyWidget *child = item->childItem()) {
@@ -984,6 +1901,7 @@ void MazeScene::updateTransforms()
                     lights << Light(QPointF(2.5, 2.5), 1)
                            << Light(QPointF(1.5, 1.5), 0.4);
                     MazeScene *embeddedScene = new MazeScene(lights, map, 5, 5);
+                    embeddedScene->startSimulation();
                     view->setScene(embeddedScene);
                     view->setRenderHints(QPainter::SmoothPixmapTransform | QPainter::Antialiasing);
                 }
@@ -998,94 +1916,165 @@ void MazeScene::updateTransforms()
     }
 #endif
     setFocusItem(0); // setVisible(true) might give focus to one of the items
-    update();
+
+    // otherwise only the items with a new transform changed, and
+    // setTransform() already invalidated their old and new bounds
+    if (cameraMoved)
+        update();
+    else
+        updateObservers();
 }
 
-void MazeScene::move()
+// Observers paint the items through cameras of their own, so the bounds
+// the items invalidate mean nothing to them and they repaint completely.
+void MazeScene::updateObservers()
 {
-    QSet<Entity *> movedEntities;
-    long elapsed = m_time.elapsed();
-    bool walked = false;
+    foreach (QGraphicsView *view, views()) {
+        View *mazeView = qobject_cast<View *>(view);
+        if (mazeView && mazeView->hasOwnCamera())
+            view->viewport()->update();
+    }
+}
 
-    const int stepSize = 5;
-    int steps = (elapsed - m_simulationTime) / stepSize;
+void MazeScene::moveEntities(int elapsed)
+{
+    const int entityCount = m_entities.size();
+    QVector<qreal> x(entityCount);
+    QVector<qreal> y(entityCount);
+    QVector<qreal> dx(entityCount);
+    QVector<qreal> dy(entityCount);
+    for (int i = 0; i < entityCount; ++i) {
+        const QPointF delta = m_entities.at(i)->plan(elapsed);
+        x[i] = m_entities.at(i)->pos().x();
+        y[i] = m_entities.at(i)->pos().y();
+        dx[i] = delta.x();
+        dy[i] = delta.y();
+    }
 
-    if (steps) {
-        m_deltaYaw /= steps;
-        m_deltaPitch /= steps;
+    tryMoveAll(x, y, dx, dy);
 
-        m_deltaYaw += m_turningSpeed;
-        m_deltaPitch += m_pitchSpeed;
+    for (int i = 0; i < entityCount; ++i) {
+        m_entities.at(i)->finishMove(QPointF(x.at(i), y.at(i)));
+        m_collisionGrid.moveEntity(i, m_entities.at(i)->pos());
     }
+}
 
-    qreal walkingVelocity = m_walkingVelocity;
+void MazeScene::post(const SimulationInput &input)
+{
+    m_simulation->post(input);
+    wake();
+}
 
-    for (int i = 0; i < steps; ++i) {
-        m_camera.setYaw(m_camera.yaw() + m_deltaYaw);
-        m_camera.setPitch(m_camera.pitch() + m_deltaPitch);
+bool MazeScene::advanceFrame(int elapsed)
+{
+    updateFromSimulation();
+    const bool animating = animateEntities(elapsed);
 
-        bool walking = false;
-        if (walkingVelocity != 0) {
-            QPointF walkingDelta = QLineF::fromPolar(walkingVelocity, m_camera.yaw() - 90).p2();
-            QPointF pos = m_camera.pos();
-            if (tryMove(pos, walkingDelta)) {
-                walking = true;
-                m_camera.setPos(pos);
-            }
-        }
+    // frames in between steps still move until the last step is reached
+    return m_simulation->isBusy() || m_simulation->progress() < 1 || animating;
+}
 
-        if (m_strafingVelocity != 0) {
-            QPointF walkingDelta = QLineF::fromPolar(m_strafingVelocity, m_camera.yaw()).p2();
-            QPointF pos = m_camera.pos();
-            if (tryMove(pos, walkingDelta)) {
-                walking = true;
-                m_camera.setPos(pos);
-            }
-        }
+// Advances the walking animation of all entities in one pass, so that they
+// change frames together. Only entities in view swap their image, and only
+// when the frame actually changes. Returns whether any entity walks.
+bool MazeScene::animateEntities(int elapsed)
+{
+    QVector<Entity *> walking;
+    foreach (Entity *entity, m_entities) {
+        if (entity->displayedState().walked)
+            walking << entity;
+    }
 
-        walked = walked || walking;
+    if (walking.isEmpty())
+        return false;
+
+    // the walking animation has four frames
+    m_animationTime = (m_animationTime + elapsed) % (4 * walkingFrameTime);
+    const int frame = m_animationTime / walkingFrameTime;
+    if (frame == m_animationFrame)
+        return true;
+
+    m_animationFrame = frame;
+    foreach (Entity *entity, walking)
+        entity->setAnimationFrame(frame);
+    updateObservers();
+    return true;
+}
+
+// picks up the latest snapshot of the simulation, if there is a new one, and
+// shows the state between its last two steps that matches the current time
+void MazeScene::updateFromSimulation()
+{
+    const bool updated = m_simulation->updateSnapshot();
+    const WorldSnapshot &snapshot = m_simulation->snapshot();
+
+    bool doorsMoved = false;
+    if (updated) {
+        if (snapshot.doorsOpening != m_doorsOpening) {
+            m_doorsOpening = snapshot.doorsOpening;
+            foreach (QPushButton *button, m_buttons)
+                button->setText(m_doorsOpening ? "Закрыть" : "Открыть");
+        }
 
-        if (walking)
-            m_walkTime += stepSize;
-        m_simulationTime += stepSize;
+        if (snapshot.doorValue != m_doorValue) {
+            m_doorValue = snapshot.doorValue;
+            moveDoors(m_doorValue);
+            doorsMoved = true;
+        }
+    }
 
-        foreach (Entity *entity, m_entities) {
-            if (entity->move(this))
-                movedEntities.insert(entity);
+    const qreal progress = m_simulation->progress();
+
+    QVector<Entity *> movedEntities;
+    for (int i = 0; i < snapshot.entities.size() && i < m_entities.size(); ++i) {
+        Entity *entity = m_entities.at(i);
+        const EntityState state = snapshot.entityAt(i, progress);
+        if (state != entity->displayedState()) {
+            const bool startsWalking = state.walked && !entity->displayedState().walked;
+            entity->setDisplayedState(state);
+
+            // animateEntities() only hands out frames when they change, an
+            // entity that starts walking joins in on the current one
+            if (startsWalking)
+                entity->setAnimationFrame(m_animationFrame);
+            movedEntities << entity;
         }
     }
 
-    m_camera.setTime(m_walkTime * 0.001);
+    const Camera camera = snapshot.cameraAt(progress);
+    const bool cameraMoved = camera.pos() != m_camera.pos()
+        || camera.yaw() != m_camera.yaw()
+        || camera.pitch() != m_camera.pitch();
+    m_camera = camera;
 
-    if (walked || m_deltaYaw != 0 || m_deltaPitch != 0) {
+    if (cameraMoved) {
         updateTransforms();
     } else {
+        // with the camera still only the moved items are repainted
+        Camera projection;
+        QTransform screen;
+        itemProjection(&projection, &screen);
         foreach (Entity *entity, movedEntities)
-            entity->updateTransform(m_camera);
-    }
+            entity->updateTransform(projection, screen);
 
-    if (steps) {
-        m_deltaYaw = 0;
-        m_deltaPitch = 0;
+        if (doorsMoved || !movedEntities.isEmpty())
+            updateObservers();
     }
+
+    if (cameraMoved || !movedEntities.isEmpty())
+        emit worldChanged();
 }
 
 void MazeScene::toggleDoors()
 {
     setFocusItem(0);
+    post(SimulationInput(SimulationInput::ToggleDoors));
+}
 
-    if (m_doorAnimation->state() == QTimeLine::Running)
-        return;
-
-    foreach (QPushButton *button, m_buttons) {
-        if (m_doorAnimation->direction() == QTimeLine::Forward)
-            button->setText("Закрыть");
-        else
-            button->setText("Открыть");
-    }
-
-    m_doorAnimation->toggleDirection();
-    m_doorAnimation->start();
+// opens or closes the doors at once, without animating them
+void MazeScene::setDoorsOpen(bool open)
+{
+    post(SimulationInput(SimulationInput::SetDoorsOpen, open));
 }
 
 void MazeScene::moveDoors(qreal value)
@@ -1101,7 +2090,7 @@ void MazeScene::moveDoors(qreal value)
         }
     }
     if (opaqueStatusChanged)
-        updateTransforms();
+        updateTransforms(false);
 }
 
 
@@ -1116,8 +2105,9 @@ void MazeScene::updateRenderer()
             view->setRenderHints(QPainter::Antialiasing);
     }
 
-   foreach (WallItem *item, m_walls)
-        item->updateLighting(m_lights, item->type() == 2);
+    m_worldRenderer.setWorld(m_walls, m_lights, QRectF(1, 1, m_width - 2, m_height - 2),
+                             floorImage(), ceilingImage());
+    updateLighting();
 }
 void MazeScene::changeurl(){
     view->load(QUrl(QLatin1String("http://www.google.ru")));
@@ -2,6 +2,7 @@
 #define MAZESCENE_H
 
 #include <GL/glew.h>
+#include <QBitArray>
 #include <QGraphicsItem>
 #include <QGraphicsScene>
 #include <QGraphicsView>
@@ -9,30 +10,28 @@
 #include <QPlainTextEdit>
 #include <QPointF>
 #include <QPushButton>
-#include <QTime>
-#include <QTimeLine>
 #include <QGLWidget>
 #include <QMatrix4x4>
 #include <QWebView>
 #include <QGLShaderProgram>
 
+#include "bsptree.h"
+#include "collisiongrid.h"
+#include "floorcaster.h"
+#include "framescheduler.h"
+#include "lightmapbaker.h"
+#include "pvs.h"
+#include "raycaster.h"
+#include "tilerasterizer.h"
+#include "worldrenderer.h"
+
 class MazeScene;
 class MediaPlayer;
 class Entity;
+class Simulation;
+struct SimulationInput;
 class WalkingItem;
 
-class View : public QGraphicsView
-{
-    Q_OBJECT
-public:
-    View();
-    void resizeEvent(QResizeEvent *event);
-    void setScene(MazeScene *scene);
-
-private:
-    MazeScene *m_scene;
-};
-
 class Camera
 {
 public:
@@ -41,6 +40,8 @@ public:
         , m_pitch(0)
         , m_fov(70)
         , m_time(0)
+        , m_cosYaw(1)
+        , m_sinYaw(0)
         , m_matrixDirty(true)
     {
     }
@@ -49,6 +50,7 @@ public:
     qreal pitch() const { return m_pitch; }
     qreal fov() const { return m_fov; }
     QPointF pos() const { return m_pos; }
+    qreal time() const { return m_time; }
 
     void setYaw(qreal yaw);
     void setPitch(qreal pitch);
@@ -59,6 +61,15 @@ public:
     const QMatrix4x4 &viewProjectionMatrix() const;
     const QMatrix4x4 &viewMatrix() const;
 
+    // maps a point on the floor plane into camera space, where the camera
+    // looks along positive y
+    QPointF mapToCamera(const QPointF &p) const
+    {
+        const qreal dx = p.x() - m_pos.x();
+        const qreal dy = p.y() - m_pos.y();
+        return QPointF(m_cosYaw * dx - m_sinYaw * dy, m_sinYaw * dx + m_cosYaw * dy);
+    }
+
 private:
     void updateMatrix() const;
 
@@ -66,6 +77,8 @@ private:
     qreal m_pitch;
     qreal m_fov;
     qreal m_time;
+    qreal m_cosYaw;
+    qreal m_sinYaw;
 
     QPointF m_pos;
 
@@ -74,6 +87,31 @@ private:
     mutable QMatrix4x4 m_viewProjectionMatrix;
 };
 
+class View : public QGraphicsView
+{
+    Q_OBJECT
+public:
+    View();
+    void resizeEvent(QResizeEvent *event);
+    void setScene(MazeScene *scene);
+
+    // makes this an observer view, which looks through its own camera
+    // instead of the scene's
+    void setCamera(const Camera &camera);
+    bool hasOwnCamera() const { return m_ownCamera; }
+
+protected:
+    void drawBackground(QPainter *painter, const QRectF &rect);
+    void drawItems(QPainter *painter, int numItems, QGraphicsItem *items[],
+                   const QStyleOptionGraphicsItem options[]);
+
+private:
+    MazeScene *m_scene;
+    int m_viewpoint;
+    bool m_ownCamera;
+    Camera m_camera;
+};
+
 class Light
 {
 public:
@@ -90,15 +128,37 @@ private:
     qreal m_intensity;
 };
 
+// alpha of the shadow over a wall at pos, 0 where the lights are brightest
+int shadowAlpha(const QVector<Light> &lights, const QPointF &pos);
+
+// the floor and the ceiling plane seen through the view projection m, the
+// planes' x and y are the scene's x and y
+void planeMatrices(const QMatrix4x4 &m, QMatrix4x4 *floor, QMatrix4x4 *ceiling);
+
 class ProjectedItem : public QGraphicsItem
 {
 public:
-    ProjectedItem(const QRectF &bounds, bool shadow = true, bool opaque = true);
+    ProjectedItem(const QRectF &bounds, bool lit = true, bool opaque = true);
 
     QPointF a() const { return m_a; }
     QPointF b() const { return m_b; }
 
-    virtual void updateTransform(const Camera &camera);
+    // screen is applied after the projection, see
+    // MazeScene::itemProjection()
+    virtual void updateTransform(const Camera &camera, const QTransform &screen = QTransform());
+
+    // transform and depth of the item as seen by camera, returns false if
+    // the item is completely behind it, items that turn towards the camera
+    // turn towards this one, see MazeScene::drawDepth() for the depth
+    virtual bool project(const Camera &camera, QTransform *transform, qreal *depth) const;
+
+    // paints the item as camera sees it, for observer views, the painter
+    // has the transform project() gave for camera
+    virtual void paintFrom(const Camera &camera, QPainter *painter);
+
+    // position in MazeScene's list of projected items
+    int index() const { return m_index; }
+    void setIndex(int index);
 
     void setOpaque(bool opaque);
     bool isOpaque() const;
@@ -108,22 +168,39 @@ public:
     void setPosition(const QPointF &a, const QPointF &b);
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
     void setAnimationTime(qreal time);
-    void setImage(const QImage &image);
-    void updateLighting(const QVector<Light> &lights, bool useConstantLight);
-
-    void setLightingEnabled(bool enabled);
+    // source is the part of image to draw, all of it if null, so items
+    // can share an atlas
+    void setImage(const QImage &image, const QRect &source = QRect());
+    const QImage &image() const { return m_image; }
+    QRect sourceRect() const { return m_source.isNull() ? m_image.rect() : m_source; }
+    const QMatrix4x4 &modelMatrix() const { return m_modelMatrix; }
+
+    // whether the lights shade the item, the image the LightmapBaker
+    // baked for it covers the whole item, it is drawn instead of image()
+    bool isLit() const { return m_lit; }
+    void setLitImage(const QImage &image);
+    const QImage &litImage() const { return m_litImage; }
 
     void setObscured(bool obscured);
     bool isObscured() const;
 
+protected:
+    static QMatrix4x4 modelMatrixFor(const QPointF &a, const QPointF &b);
+    bool projectPlacement(const Camera &camera, const QPointF &a, const QPointF &b,
+                          const QMatrix4x4 &model, QTransform *transform, qreal *depth) const;
+
 private:
     QPointF m_a;
     QPointF m_b;
     QRectF m_bounds;
     QRectF m_targetRect;
+    QMatrix4x4 m_modelMatrix;
     QImage m_image;
-    QGraphicsRectItem *m_shadowItem;
+    QRect m_source;
+    QImage m_litImage;
 
+    int m_index;
+    bool m_lit;
     bool m_opaque;
     bool m_obscured;
 };
@@ -142,17 +219,66 @@ public:
 
     void childResized();
 
+    // shades the widget on the wall, the wall itself is baked or lit by
+    // the renderer
+    void updateLighting(const QVector<Light> &lights);
+
 private:
+    void updateChildShade();
+
     QGraphicsProxyWidget *m_childItem;
     int m_type;
     qreal m_scale;
+
+    // shadow alpha at each scene unit along the wall, from b to a
+    QVector<int> m_shades;
+};
+
+// Per camera state of the visibility pass. The scene has one for its own
+// camera and one for every observer view, they only share the world.
+struct Viewpoint
+{
+    Viewpoint();
+
+    Camera camera;
+
+    // endpoints mapped into camera space once per frame
+    SegmentStore cameraWalls;
+    SegmentStore cameraDynamic;
+    QVector<uchar> wallsInView;
+    QVector<uchar> dynamicInView;
+
+    QBitArray potentiallyVisible;
+    bool potentiallyVisibleValid;
+    int pvsCell;
+    bool pvsDoorsOpen;
+
+    // state of the previous visibility pass
+    bool visibilityValid;
+    bool visibilityDoorsOpen;
+    Camera visibilityCamera;
+    QVector<int> visibleSegments;
+
+    // the visible parts of the opaque walls in scene coordinates, the floor
+    // and the ceiling are only drawn around them
+    QVector<QLineF> visibleWallLines;
+
+    // items visible from the camera, marked by ProjectedItem::index()
+    QBitArray visible;
+    QVector<ProjectedItem *> visibleItems;
+    QVector<ProjectedItem *> previousVisibleItems;
+
+    // transform and depth of each visible item, only kept for observers
+    QVector<QTransform> transforms;
+    QVector<qreal> depths;
 };
 
-class MazeScene : public QGraphicsScene
+class MazeScene : public QGraphicsScene, public FrameClient
 {
     Q_OBJECT
 public:
     MazeScene(const QVector<Light> &lights, const char *map, int width, int height);
+    ~MazeScene();
 
     void addProjectedItem(ProjectedItem *item);
     void addEntity(Entity *entity);
@@ -161,7 +287,76 @@ public:
 
     bool tryMove(QPointF &pos, const QPointF &delta, Entity *entity = 0) const;
 
+    // the camera, the entities and the doors move in a thread of their
+    // own once it is started, the scene draws the snapshots it publishes
+    Simulation *simulation() const { return m_simulation; }
+    void startSimulation();
+
+    // hands input over to the simulation, the scene takes frames until
+    // the simulation has settled again
+    void post(const SimulationInput &input);
+
+    // advances all entities by elapsed milliseconds, on the simulation thread
+    void moveEntities(int elapsed);
+
+    // whether the collision rectangle of entity, or of the camera if it
+    // is 0, would overlap anything at pos
+    bool blocked(const QPointF &pos, Entity *entity) const;
+
+    // tryMove() for all entities at once, entity i walks from (x[i], y[i])
+    // by up to (dx[i], dy[i]) and the arrays receive where it got to
+    void tryMoveAll(QVector<qreal> &x, QVector<qreal> &y,
+                    const QVector<qreal> &dx, const QVector<qreal> &dy);
+
     Camera camera() const { return m_camera; }
+    void setCamera(const Camera &camera);
+
+    // the stages of updating the scene for a new camera, updateTransforms()
+    // runs them all, they are public so that they can be timed apart
+    void updateVisibility();
+    void updateItemTransforms();
+    void itemProjection(Camera *camera, QTransform *screen) const;
+    // bakes the lights into the walls that came into view
+    void updateLighting();
+    bool drawsWallsWithOpenGL() const;
+    void computeVisibility(Viewpoint &viewpoint, bool doorsOpen) const;
+
+    // how far back item, placed from a to b, is drawn as seen from pos
+    qreal drawDepth(const QPointF &pos, const ProjectedItem *item, const QPointF &a, const QPointF &b) const;
+
+    // observer cameras, see View::setCamera()
+    int addViewpoint(const Camera &camera);
+    void setViewpointCamera(int index, const Camera &camera);
+    Camera viewpointCamera(int index) const { return m_viewpoints.at(index).camera; }
+    void drawViewpoint(int index, QPainter *painter);
+    // in software, rect is the part of the scene to fill
+    void drawFloorAndCeiling(QPainter *painter, const QRectF &rect, int viewpoint);
+
+    // the OpenGL renderer of the walls, if painter can use it
+    WorldRenderer *worldRenderer(QPainter *painter);
+    void drawWalls(QPainter *painter, const QVector<int> &walls);
+
+    // how the scene's own camera is drawn, through the items, with the
+    // software raycaster instead of them, or with the items painted in
+    // software on all cores
+    enum RenderMode
+    {
+        ItemRendering,
+        Raycasting,
+        TileRasterizing
+    };
+
+    void setRenderMode(RenderMode mode);
+    RenderMode renderMode() const { return m_renderMode; }
+
+    // 0 when the render mode does not use them
+    const Raycaster *raycaster() const { return m_renderMode == Raycasting ? &m_raycaster : 0; }
+    TileRasterizer *tileRasterizer() { return m_renderMode == TileRasterizing ? &m_tileRasterizer : 0; }
+
+    const QVector<ProjectedItem *> &visibleItems() const { return m_viewpoints.at(0).visibleItems; }
+    const QVector<Light> &lights() const { return m_lights; }
+    int wallCount() const { return m_walls.size(); }
+    const QVector<Entity *> &entities() const { return m_entities; }
 
     void viewResized(QGraphicsView *view);
     QWebView *view;
@@ -175,10 +370,14 @@ protected:
 
     bool handleKey(int key, bool pressed);
 
+signals:
+    // the camera or an entity moved
+    void worldChanged();
+
 public slots:
-    void move();
-  //  void toggleRenderer();
+    void toggleRenderer();
     void toggleDoors();
+    void setDoorsOpen(bool open);
     void loadFinished();
     void updateRenderer();
     void changeurl();
@@ -186,9 +385,18 @@ public slots:
 private slots:
     void moveDoors(qreal value);
 
+protected:
+    bool advanceFrame(int elapsed);
+
 private:
-    bool blocked(const QPointF &pos, Entity *entity) const;
-    void updateTransforms();
+    void updateFromSimulation();
+    bool animateEntities(int elapsed);
+    qreal sweep(const QPointF &pos, Qt::Orientation orientation, qreal distance, Entity *me) const;
+    bool arePassagesOpen() const;
+    void updateTransforms(bool cameraMoved = true);
+    void updateObservers();
+    const QBitArray *potentiallyVisibleWalls(Viewpoint &viewpoint, bool doorsOpen);
+    bool areDoorsOpen() const;
 
 
     QVector<WallItem *> m_walls;
@@ -201,20 +409,39 @@ private:
     int m_height;
     QVector<ProjectedItem *> m_projectedItems;
 
+    // walls live in the BSP tree, everything else is tested every frame
+    BspTree m_bspTree;
+    QVector<ProjectedItem *> m_dynamicItems;
+
+    // the segments of the BSP tree each wall was cut into, by
+    // ProjectedItem::index()
+    QVector<QVector<int> > m_itemSegments;
+    QVector<WallItem *> m_widgetWalls;
+    SegmentStore m_dynamicEndpoints;
 
+    PotentiallyVisibleSet m_pvs;
+    CollisionGrid m_collisionGrid;
+
+    // the scene's own camera comes first
+    QVector<Viewpoint> m_viewpoints;
+
+    // the camera of the last snapshot drawn
     Camera m_camera;
 
-    qreal m_walkingVelocity;
-    qreal m_strafingVelocity;
-    qreal m_turningSpeed;
-    qreal m_pitchSpeed;
-
-    qreal m_deltaYaw;
-    qreal m_deltaPitch;
-    QTime m_time;
-    QTimeLine *m_doorAnimation;
-    long m_simulationTime;
-    long m_walkTime;
+    Simulation *m_simulation;
+    qreal m_doorValue;
+    bool m_doorsOpening;
+
+    LightmapBaker m_lightmapBaker;
+    WorldRenderer m_worldRenderer;
+    FloorCaster m_floorCaster;
+    Raycaster m_raycaster;
+    TileRasterizer m_tileRasterizer;
+    RenderMode m_renderMode;
+
+    // clock of the walking animation, shared by all entities
+    int m_animationTime;
+    int m_animationFrame;
 
     MediaPlayer *m_player;
     QPointF m_playerPos;
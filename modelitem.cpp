@@ -2,14 +2,16 @@
 #include "model.h"
 
 #include <QtGui>
+#include <QGLPixelBuffer>
 #include "mazescene.h"
 
 
 #define GL_MULTISAMPLE  0x809D
 
 #include <QVector2D>
+#include <QVector4D>
 
-void ModelItem::updateTransform(const Camera &camera)
+void ModelItem::updateTransform(const Camera &camera, const QTransform &screen)
 {
     QPointF pos(3, 7);
 
@@ -18,16 +20,24 @@ void ModelItem::updateTransform(const Camera &camera)
 
     setPosition(pos - delta, pos + delta);
 
-    ProjectedItem::updateTransform(camera);
+    ProjectedItem::updateTransform(camera, screen);
 
     setTransform(QTransform());
 
     m_matrix = camera.viewMatrix();
     m_matrix.translate(3, 0, 7);
+    updateFootprint();
+
+    // the model spins while it can be seen
+    if (!isObscured())
+        wake();
 }
 
 QRectF ModelItem::boundingRect() const
 {
+    if (!m_footprint.isNull())
+        return m_footprint;
+
     if (!scene()->views().isEmpty()) {
         QGraphicsView *view = scene()->views().at(0);
         return view->mapToScene(view->rect()).boundingRect();
@@ -41,6 +51,15 @@ void ModelItem::updateItem()
     ProjectedItem::update();
 }
 
+bool ModelItem::advanceFrame(int)
+{
+    if (!m_model || isObscured())
+        return false;
+
+    ProjectedItem::update();
+    return true;
+}
+
 const char *vertexProgram =
     "attribute highp    vec4    vertexCoordsArray;"
     "attribute highp    vec4    normalCoordsArray;"
@@ -64,20 +83,113 @@ const char *fragmentProgram =
 QMatrix4x4 fromProjection(float fov);
 QMatrix4x4 fromRotation(float angle, Qt::Axis axis);
 
+// scales models to about the size of a door
+static float modelScale(const QVector3D &size)
+{
+    float extent = qSqrt(2.0);
+    return 1 / qMax(size.y(), qMax(size.x() / extent, size.z() / extent));
+}
+
+// The model is centered and spins, so it stays inside the cube around its
+// bounding sphere. The footprint is where that cube lands on screen, or
+// unknown if the cube reaches behind the camera.
+void ModelItem::updateFootprint()
+{
+    QRectF footprint;
+    if (m_model) {
+        const float r = 0.5 * modelScale(m_model->size()) * m_model->size().length();
+        const QMatrix4x4 m = fromProjection(70) * m_matrix;
+
+        qreal left = 0, top = 0, right = 0, bottom = 0;
+        for (int i = 0; i < 8; ++i) {
+            const QVector4D p = m * QVector4D(i & 1 ? r : -r, i & 2 ? r : -r, i & 4 ? r : -r, 1);
+            if (p.w() <= 0.01) {
+                left = right = 0;
+                break;
+            }
+
+            const qreal x = p.x() / p.w();
+            const qreal y = p.y() / p.w();
+            left = i ? qMin(left, x) : x;
+            right = i ? qMax(right, x) : x;
+            top = i ? qMin(top, y) : y;
+            bottom = i ? qMax(bottom, y) : y;
+        }
+
+        // a little extra for antialiased edges
+        if (right > left)
+            footprint = QRectF(left, top, right - left, bottom - top).adjusted(-0.01, -0.01, 0.01, 0.01);
+    }
+
+    if (footprint != m_footprint) {
+        prepareGeometryChange();
+        m_footprint = footprint;
+    }
+}
+
 void ModelItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
 {
     if (!m_model || isObscured())
         return;
 
+    const QPaintEngine::Type type = painter->paintEngine()->type();
+    if (type == QPaintEngine::OpenGL || type == QPaintEngine::OpenGL2)
+        paintModel(painter);
+    else
+        paintOffscreen(painter);
+}
+
+// The raycaster and the tile rasterizer paint without a GL context, so the
+// model is rendered into a pixel buffer over its footprint and the image
+// is painted from there. Without pixel buffers the model is not shown.
+void ModelItem::paintOffscreen(QPainter *painter)
+{
+    if (!QGLPixelBuffer::hasOpenGLPbuffers())
+        return;
+
+    const QRect device(0, 0, painter->device()->width(), painter->device()->height());
+    const QRect rect = painter->transform().mapRect(boundingRect()).toAlignedRect() & device;
+    if (rect.isEmpty())
+        return;
+
+    // the buffer only grows, the program belongs to its context
+    if (!m_pixelBuffer || m_pixelBuffer->width() < rect.width() || m_pixelBuffer->height() < rect.height()) {
+        QSize size = rect.size();
+        if (m_pixelBuffer) {
+            size = size.expandedTo(m_pixelBuffer->size());
+            m_pixelBuffer->makeCurrent();
+            delete m_program;
+            m_program = 0;
+            delete m_pixelBuffer;
+        }
+        m_pixelBuffer = new QGLPixelBuffer(size, QGLFormat(QGL::DepthBuffer | QGL::AlphaChannel));
+    }
+
+    QPainter buffer(m_pixelBuffer);
+    buffer.setCompositionMode(QPainter::CompositionMode_Source);
+    buffer.fillRect(QRect(QPoint(0, 0), rect.size()), Qt::transparent);
+    buffer.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    buffer.setTransform(painter->transform() * QTransform::fromTranslate(-rect.left(), -rect.top()));
+    paintModel(&buffer);
+    buffer.end();
+
+    const QImage image = m_pixelBuffer->toImage();
+    painter->save();
+    painter->resetTransform();
+    painter->drawImage(rect.topLeft(), image, QRect(QPoint(0, 0), rect.size()));
+    painter->restore();
+}
+
+// paints the model with a painter on an OpenGL device
+void ModelItem::paintModel(QPainter *painter)
+{
     QMatrix4x4 projectionMatrix = QMatrix4x4(painter->transform()) * fromProjection(70);
 
     const int delta = m_time.elapsed() - m_lastTime;
     m_rotation += m_angularMomentum * (delta / 1000.0);
     m_lastTime += delta;
 
-    QVector3D size = m_model->size();
-    float extent = qSqrt(2.0);
-    float scale = 1 / qMax(size.y(), qMax(size.x() / extent, size.z() / extent));
+    float scale = modelScale(m_model->size());
     QMatrix4x4 modelMatrix;
     modelMatrix.scale(scale, -scale, scale);
 
@@ -85,8 +197,6 @@ void ModelItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidg
     modelMatrix = fromRotation(m_rotation.y(), Qt::YAxis) * modelMatrix;
     modelMatrix = fromRotation(m_rotation.x(), Qt::XAxis) * modelMatrix;
 
-    QTimer::singleShot(10, this, SLOT(updateItem()));
-
 
     m_wireframe->setEnabled(true);
 
@@ -142,6 +252,7 @@ ModelItem::ModelItem()
     , m_distance(1.4f)
     , m_angularMomentum(0, 40, 0)
     , m_program(0)
+    , m_pixelBuffer(0)
 {
     setLayout(new QVBoxLayout);
 
@@ -206,8 +317,10 @@ void ModelItem::setModel(Model *model)
 {
     delete m_model;
     m_model = model;
+    updateFootprint();
 
     ProjectedItem::update();
+    wake();
 }
 
 void ModelItem::enableWireframe(bool enabled)
@@ -14,19 +14,20 @@
 #include "mazescene.h"
 
 QT_BEGIN_NAMESPACE
+class QGLPixelBuffer;
 class QGLShaderProgram;
 QT_END_NAMESPACE
 
 class Model;
 
-class ModelItem : public QWidget, public ProjectedItem
+class ModelItem : public QWidget, public ProjectedItem, public FrameClient
 {
     Q_OBJECT
 
 public:
     ModelItem();
 
-    void updateTransform(const Camera &camera);
+    void updateTransform(const Camera &camera, const QTransform &screen = QTransform());
 
     QRectF boundingRect() const;
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
@@ -40,8 +41,14 @@ public slots:
     void modelLoaded();
     void updateItem();
 
+protected:
+    bool advanceFrame(int elapsed);
+
 private:
     void setModel(Model *model);
+    void updateFootprint();
+    void paintModel(QPainter *painter);
+    void paintOffscreen(QPainter *painter);
 
     bool m_wireframeEnabled;
     bool m_normalsEnabled;
@@ -68,8 +75,14 @@ private:
 #endif
     QMatrix4x4 m_matrix;
 
+    // where the spinning model can end up on screen, null if unknown
+    QRectF m_footprint;
+
 #ifndef QT_NO_OPENGL
     mutable QGLShaderProgram *m_program;
+
+    // where the model is rendered when the view paints without OpenGL
+    QGLPixelBuffer *m_pixelBuffer;
 #endif
 };
 
@@ -0,0 +1,379 @@
+#include "pvs.h"
+
+#include <qmath.h>
+
+// Lines are followed in four directions, each with the lines that run at
+// most 45 degrees off the direction. Cells are addressed by (u, v) there,
+// u along the direction and v across it, and a line is v = m * u + c with
+// m in [-1, 1]. The lines still possible are kept as a convex polygon of
+// (m, c) points.
+enum Direction
+{
+    East,
+    West,
+    South,
+    North
+};
+
+// the side of a cell crossed when u grows by one
+static const PotentiallyVisibleSet::Side forwardSide[] = {
+    PotentiallyVisibleSet::Right,
+    PotentiallyVisibleSet::Left,
+    PotentiallyVisibleSet::Bottom,
+    PotentiallyVisibleSet::Top
+};
+
+// the side of a cell crossed when v grows by one
+static const PotentiallyVisibleSet::Side acrossSide[] = {
+    PotentiallyVisibleSet::Bottom,
+    PotentiallyVisibleSet::Bottom,
+    PotentiallyVisibleSet::Right,
+    PotentiallyVisibleSet::Right
+};
+
+static PotentiallyVisibleSet::Side oppositeSide(PotentiallyVisibleSet::Side side)
+{
+    switch (side) {
+    case PotentiallyVisibleSet::Top:
+        return PotentiallyVisibleSet::Bottom;
+    case PotentiallyVisibleSet::Bottom:
+        return PotentiallyVisibleSet::Top;
+    case PotentiallyVisibleSet::Left:
+        return PotentiallyVisibleSet::Right;
+    default:
+        return PotentiallyVisibleSet::Left;
+    }
+}
+
+static void toMap(int direction, int u, int v, int *x, int *y)
+{
+    switch (direction) {
+    case East:
+        *x = u;
+        *y = v;
+        break;
+    case West:
+        *x = -1 - u;
+        *y = v;
+        break;
+    case South:
+        *x = v;
+        *y = u;
+        break;
+    default:
+        *x = v;
+        *y = -1 - u;
+        break;
+    }
+}
+
+static void fromMap(int direction, int x, int y, int *u, int *v)
+{
+    switch (direction) {
+    case East:
+        *u = x;
+        *v = y;
+        break;
+    case West:
+        *u = -1 - x;
+        *v = y;
+        break;
+    case South:
+        *u = y;
+        *v = x;
+        break;
+    default:
+        *u = -1 - y;
+        *v = x;
+        break;
+    }
+}
+
+// keeps the lines with m * u + c >= bound, or <= bound if below is set,
+// less the ones that only graze it, through the corner where two walls
+// meet nothing can be seen
+static QVector<QPointF> clip(const QVector<QPointF> &lines, qreal u, qreal bound, bool below)
+{
+    const qreal slack = -1e-9;
+
+    QVector<QPointF> result;
+    for (int i = 0; i < lines.size(); ++i) {
+        const QPointF &p = lines.at(i);
+        const QPointF &q = lines.at((i + 1) % lines.size());
+        const qreal dp = p.x() * u + p.y() - bound;
+        const qreal dq = q.x() * u + q.y() - bound;
+        const qreal fp = (below ? -dp : dp) + slack;
+        const qreal fq = (below ? -dq : dq) + slack;
+        if (fp >= 0)
+            result << p;
+        if ((fp >= 0) != (fq >= 0))
+            result << p + (q - p) * (fp / (fp - fq));
+    }
+    return result;
+}
+
+static QVector<QPointF> clipBetween(const QVector<QPointF> &lines, qreal u, qreal low, qreal high)
+{
+    return clip(clip(lines, u, low, false), u, high, true);
+}
+
+// the values of v the lines take at u
+static void range(const QVector<QPointF> &lines, qreal u, qreal *low, qreal *high)
+{
+    *low = *high = lines.at(0).x() * u + lines.at(0).y();
+    for (int i = 1; i < lines.size(); ++i) {
+        const qreal v = lines.at(i).x() * u + lines.at(i).y();
+        *low = qMin(*low, v);
+        *high = qMax(*high, v);
+    }
+}
+
+PotentiallyVisibleSet::PotentiallyVisibleSet()
+    : m_width(0)
+    , m_height(0)
+    , m_stamp(0)
+{
+}
+
+void PotentiallyVisibleSet::setMap(const QVector<CellKind> &cells, const QVector<int> &edgeWalls,
+                                   int width, int height)
+{
+    m_cells = cells;
+    m_edgeWalls = edgeWalls;
+    m_width = width;
+    m_height = height;
+
+    m_sets.clear();
+    m_sets.resize(width * height);
+    m_computed.fill(false, width * height);
+
+    int wallCount = 0;
+    foreach (int wall, edgeWalls)
+        wallCount = qMax(wallCount, wall + 1);
+    m_seen.fill(0, wallCount);
+    m_stamp = 0;
+}
+
+const PotentiallyVisibleSet::Cell *PotentiallyVisibleSet::cell(int x, int y)
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return 0;
+
+    const int index = y * m_width + x;
+    if (m_cells.at(index) != Open && m_cells.at(index) != Door)
+        return 0;
+
+    if (!m_computed.testBit(index)) {
+        compute(index);
+        m_computed.setBit(index);
+    }
+
+    return &m_sets.at(index);
+}
+
+// Follows every straight line out of the cell, so that no position of the
+// camera inside it and no direction is missed. The walls reached with the
+// doors closed are found first, then the ones the open doors add.
+void PotentiallyVisibleSet::compute(int index)
+{
+    // stamps 2n + 1 mark walls seen directly, 2n + 2 walls behind doors
+    m_stamp += 2;
+
+    Cell &result = m_sets[index];
+    const int x = index % m_width;
+    const int y = index / m_width;
+
+    // the camera can be in a door cell when the doors shut, so door cells
+    // get the closed pass as well, with their own cell passable
+    const Side sides[] = { Top, Bottom, Left, Right };
+    for (int doorsOpen = 0; doorsOpen < 2; ++doorsOpen) {
+        for (int i = 0; i < 4; ++i)
+            addEdge(x, y, sides[i], doorsOpen, &result);
+
+        for (int direction = East; direction <= North; ++direction) {
+            int u, v;
+            fromMap(direction, x, y, &u, &v);
+
+            const qreal extent = 2 * (m_width + m_height) + 4;
+            QVector<QPointF> lines;
+            lines << QPointF(-1, -extent) << QPointF(1, -extent) << QPointF(1, extent) << QPointF(-1, extent);
+
+            // a line crosses the cell if it is below its top at one side
+            // and above its bottom at the other, whichever way it slopes
+            castLines(x, y, direction, doorsOpen, clip(clip(lines, u, v, false), u + 1, v + 1, true), &result);
+            castLines(x, y, direction, doorsOpen, clip(clip(lines, u + 1, v, false), u, v + 1, true), &result);
+        }
+    }
+
+    // a wall seen both directly and through a door is not gated
+    QVector<int> gated;
+    foreach (int wall, result.gated) {
+        if (m_seen.at(wall) != m_stamp - 1)
+            gated << wall;
+    }
+    result.gated = gated;
+
+#ifndef QT_NO_DEBUG
+    // the walls around the cell are always seen, doors closed or not
+    for (int i = 0; i < 4; ++i) {
+        const int wall = m_edgeWalls.at(4 * index + sides[i]);
+        Q_ASSERT(wall < 0 || m_seen.at(wall) == m_stamp - 1);
+    }
+#endif
+}
+
+void PotentiallyVisibleSet::addWall(int wall, bool gated, Cell *result)
+{
+    if (wall < 0)
+        return;
+
+    const int stamp = gated ? m_stamp : m_stamp - 1;
+    if (m_seen.at(wall) == m_stamp - 1 || m_seen.at(wall) == stamp)
+        return;
+
+    m_seen[wall] = stamp;
+    if (gated)
+        result->gated << wall;
+    else
+        result->walls << wall;
+}
+
+// either of the two cells might have a wall on the edge
+void PotentiallyVisibleSet::addEdge(int x, int y, Side side, bool gated, Cell *result)
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return;
+    addWall(m_edgeWalls.at(4 * (y * m_width + x) + side), gated, result);
+
+    const int nx = x + (side == Left ? -1 : side == Right ? 1 : 0);
+    const int ny = y + (side == Top ? -1 : side == Bottom ? 1 : 0);
+    if (nx < 0 || ny < 0 || nx >= m_width || ny >= m_height)
+        return;
+    addWall(m_edgeWalls.at(4 * (ny * m_width + nx) + oppositeSide(side)), gated, result);
+}
+
+bool PotentiallyVisibleSet::isPassable(int x, int y, bool doorsOpen) const
+{
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return false;
+
+    const CellKind kind = m_cells.at(y * m_width + x);
+    return kind == Open || kind == Translucent || (kind == Door && doorsOpen);
+}
+
+// extends run along its column to all passable cells next to it
+void PotentiallyVisibleSet::growRun(int direction, bool doorsOpen, ColumnRun *run) const
+{
+    int x, y;
+    for (;;) {
+        toMap(direction, run->u, run->top - 1, &x, &y);
+        if (!isPassable(x, y, doorsOpen))
+            break;
+        --run->top;
+    }
+    for (;;) {
+        toMap(direction, run->u, run->bottom, &x, &y);
+        if (!isPassable(x, y, doorsOpen))
+            break;
+        ++run->bottom;
+    }
+}
+
+// Walks the lines out of cell (sx, sy) column by column, recording the
+// walls on every edge some of them cross. The lines that stay in a run of
+// passable cells through a column are split by the runs of the next column
+// they enter, so each run of cells only ever sees the lines that got there.
+void PotentiallyVisibleSet::castLines(int sx, int sy, int direction, bool doorsOpen,
+                                      const QVector<QPointF> &lines, Cell *result)
+{
+    if (lines.isEmpty())
+        return;
+
+    const Side forward = forwardSide[direction];
+    const Side across = acrossSide[direction];
+    const Side back = oppositeSide(across);
+
+    int su, sv;
+    fromMap(direction, sx, sy, &su, &sv);
+
+    ColumnRun first;
+    first.u = su;
+    first.top = sv;
+    first.bottom = sv + 1;
+    first.lines = lines;
+    growRun(direction, doorsOpen, &first);
+
+    QVector<ColumnRun> stack;
+    stack << first;
+    while (!stack.isEmpty()) {
+        const ColumnRun run = stack.last();
+        stack.pop_back();
+
+        const int u = run.u;
+        int x, y;
+
+        qreal enterLow, enterHigh;
+        qreal leaveLow, leaveHigh;
+        range(run.lines, u, &enterLow, &enterHigh);
+        range(run.lines, u + 1, &leaveLow, &leaveHigh);
+
+        // in the first column the lines start inside the source cell
+        if (u == su) {
+            enterLow = sv;
+            enterHigh = sv + 1;
+        }
+
+        // lines leaving the run through its ends within the column
+        if (leaveLow < run.top) {
+            toMap(direction, u, run.top, &x, &y);
+            addEdge(x, y, back, doorsOpen, result);
+        }
+        if (leaveHigh > run.bottom) {
+            toMap(direction, u, run.bottom - 1, &x, &y);
+            addEdge(x, y, across, doorsOpen, result);
+        }
+
+        // edges inside the run, translucent walls and door frames
+        const int firstEdge = qMax(run.top + 1, qFloor(qMin(enterLow, leaveLow)));
+        const int lastEdge = qMin(run.bottom - 1, qCeil(qMax(enterHigh, leaveHigh)));
+        for (int v = firstEdge; v <= lastEdge; ++v) {
+            toMap(direction, u, v, &x, &y);
+            addEdge(x, y, back, doorsOpen, result);
+        }
+
+        const QVector<QPointF> through = clipBetween(run.lines, u + 1, run.top, run.bottom);
+        if (through.isEmpty())
+            continue;
+
+        qreal low, high;
+        range(through, u + 1, &low, &high);
+        const int firstRow = qMax(run.top, qFloor(low));
+        const int lastRow = qMin(run.bottom - 1, qFloor(high));
+        for (int v = firstRow; v <= lastRow; ++v) {
+            toMap(direction, u, v, &x, &y);
+            addEdge(x, y, forward, doorsOpen, result);
+
+            int nx, ny;
+            toMap(direction, u + 1, v, &nx, &ny);
+            if (!isPassable(nx, ny, doorsOpen))
+                continue;
+
+            ColumnRun next;
+            next.u = u + 1;
+            next.top = v;
+            next.bottom = v + 1;
+            growRun(direction, doorsOpen, &next);
+
+            // the rest of the rows lead into the same run
+            for (int row = v + 1; row < next.bottom && row <= lastRow; ++row) {
+                toMap(direction, u, row, &x, &y);
+                addEdge(x, y, forward, doorsOpen, result);
+            }
+            v = next.bottom - 1;
+
+            next.lines = clipBetween(through, u + 1, next.top, next.bottom);
+            if (!next.lines.isEmpty())
+                stack << next;
+        }
+    }
+}
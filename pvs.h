@@ -0,0 +1,80 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <QBitArray>
+#include <QPointF>
+#include <QVector>
+
+// Potentially visible set of walls for every cell of a grid map. The set
+// of a cell holds every wall some straight line out of the cell reaches,
+// so it is conservative for any camera position inside the cell. It is
+// computed the first time the cell is asked for.
+class PotentiallyVisibleSet
+{
+public:
+    enum CellKind
+    {
+        Solid,
+        Open,
+        Door,
+        Translucent
+    };
+
+    enum Side
+    {
+        Top,
+        Bottom,
+        Left,
+        Right
+    };
+
+    struct Cell
+    {
+        // walls visible with all doors closed
+        QVector<int> walls;
+
+        // walls that can only be seen through an open door
+        QVector<int> gated;
+    };
+
+    PotentiallyVisibleSet();
+
+    // edgeWalls holds the index of the wall on each side of each cell,
+    // at 4 * cell + side, or -1 if there is none
+    void setMap(const QVector<CellKind> &cells, const QVector<int> &edgeWalls, int width, int height);
+
+    // returns 0 for cells the camera can not be in
+    const Cell *cell(int x, int y);
+
+private:
+    // cells [top, bottom) of column u and the lines that reach them, as
+    // a convex polygon of (m, c) for lines v = m * u + c
+    struct ColumnRun
+    {
+        int u;
+        int top;
+        int bottom;
+        QVector<QPointF> lines;
+    };
+
+    void compute(int index);
+    void castLines(int sx, int sy, int direction, bool doorsOpen, const QVector<QPointF> &lines, Cell *result);
+    void growRun(int direction, bool doorsOpen, ColumnRun *run) const;
+    bool isPassable(int x, int y, bool doorsOpen) const;
+    void addEdge(int x, int y, Side side, bool gated, Cell *result);
+    void addWall(int wall, bool gated, Cell *result);
+
+    QVector<CellKind> m_cells;
+    QVector<int> m_edgeWalls;
+    int m_width;
+    int m_height;
+
+    QVector<Cell> m_sets;
+    QBitArray m_computed;
+
+    // per wall markers used to avoid duplicates while computing a cell
+    QVector<int> m_seen;
+    int m_stamp;
+};
+
+#endif
@@ -0,0 +1,469 @@
+#include "raycaster.h"
+
+#include <QPainter>
+#include <QVector4D>
+#include <qmath.h>
+
+#include <limits>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "entity.h"
+#include "mazescene.h"
+#include "pvs.h"
+
+// sprites are cut off this close to the camera
+static const qreal nearDepth = 0.01;
+
+static const int oppositeSide[] = {
+    PotentiallyVisibleSet::Bottom,
+    PotentiallyVisibleSet::Top,
+    PotentiallyVisibleSet::Right,
+    PotentiallyVisibleSet::Left
+};
+
+// maps a point at height y above the floor plane position pos through m
+// and the painter's transform
+static QPointF toDevice(const QMatrix4x4 &m, const QTransform &device, const QPointF &pos, qreal y)
+{
+    const QVector4D p = m * QVector4D(pos.x(), y, pos.y(), 1);
+    return device.map(QPointF(p.x() / p.w(), p.y() / p.w()));
+}
+
+static inline QRgb shadePixel(QRgb pixel, int shade)
+{
+    return qRgba(qRed(pixel) * shade >> 8, qGreen(pixel) * shade >> 8, qBlue(pixel) * shade >> 8, qAlpha(pixel));
+}
+
+// source over for premultiplied pixels
+static inline QRgb blendPixel(QRgb source, QRgb destination)
+{
+    const int inverse = 255 - qAlpha(source);
+    return qRgba(qRed(source) + qRed(destination) * inverse / 255,
+                 qGreen(source) + qGreen(destination) * inverse / 255,
+                 qBlue(source) + qBlue(destination) * inverse / 255,
+                 qAlpha(source) + qAlpha(destination) * inverse / 255);
+}
+
+#if defined(__SSE2__)
+// _mm_mullo_epi32() needs SSE4.1
+static inline __m128i multiply(__m128i a, __m128i b)
+{
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+// Stretches a texture column over count pixels of a column of the buffer,
+// v is the texel row of the first pixel and dv how far each pixel steps.
+// With SSE2 the texel rows and the shading of four pixels are computed at
+// once.
+static void wallColumn(QRgb *pixels, int stride, int count, float v, float dv,
+                       const QRgb *texels, int texelStride, int height, int shade)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 steps = _mm_setr_ps(0, 1, 2, 3);
+    const __m128 vdv = _mm_set1_ps(dv);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lastRow = _mm_set1_epi32(height - 1);
+    const __m128i vstride = _mm_set1_epi32(texelStride);
+
+    // the pixels are unpacked to 16 bits per channel, alpha stays as it is
+    const __m128i multiplier = _mm_setr_epi16(shade, shade, shade, 256, shade, shade, shade, 256);
+
+    for (; i + 4 <= count; i += 4) {
+        const __m128 rows = _mm_add_ps(_mm_set1_ps(v + i * dv), _mm_mul_ps(steps, vdv));
+        __m128i row = _mm_cvttps_epi32(rows);
+        row = _mm_andnot_si128(_mm_cmplt_epi32(row, zero), row);
+        const __m128i beyond = _mm_cmpgt_epi32(row, lastRow);
+        row = _mm_or_si128(_mm_and_si128(beyond, lastRow), _mm_andnot_si128(beyond, row));
+
+        int index[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(index), multiply(row, vstride));
+        __m128i texel = _mm_setr_epi32(texels[index[0]], texels[index[1]], texels[index[2]], texels[index[3]]);
+
+        const __m128i low = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(texel, zero), multiplier), 8);
+        const __m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(texel, zero), multiplier), 8);
+        texel = _mm_packus_epi16(low, high);
+
+        QRgb shaded[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(shaded), texel);
+        for (int j = 0; j < 4; ++j)
+            pixels[(i + j) * stride] = shaded[j];
+    }
+#endif
+
+    for (; i < count; ++i) {
+        const int row = qBound(0, int(v + i * dv), height - 1);
+        pixels[i * stride] = shadePixel(texels[row * texelStride], shade);
+    }
+}
+
+Raycaster::Raycaster()
+    : m_width(0)
+    , m_height(0)
+{
+}
+
+void Raycaster::setMap(int width, int height, const QVector<int> &edgeWalls, const QVector<WallItem *> &walls)
+{
+    m_width = width;
+    m_height = height;
+    m_edgeWalls = edgeWalls;
+
+    // entities added before the map stay registered
+    foreach (WallItem *wall, m_walls)
+        m_items.remove(wall);
+    m_walls = walls;
+    foreach (WallItem *wall, walls)
+        m_items << wall;
+}
+
+void Raycaster::addItem(QGraphicsItem *item)
+{
+    m_items << item;
+}
+
+// Walks the ray from the camera along direction, which is one unit long
+// along the view axis, so that the distance walked is the depth. Walls
+// belong to the open cell they face, so both cells of an edge are checked.
+bool Raycaster::castRay(const QPointF &direction, qreal doorTime, Hit *hit) const
+{
+    const QPointF &pos = m_projection.pos;
+    int x = qFloor(pos.x());
+    int y = qFloor(pos.y());
+
+    const qreal infinity = std::numeric_limits<qreal>::infinity();
+    const int stepX = direction.x() > 0 ? 1 : -1;
+    const int stepY = direction.y() > 0 ? 1 : -1;
+    const qreal deltaX = direction.x() != 0 ? qAbs(1 / direction.x()) : infinity;
+    const qreal deltaY = direction.y() != 0 ? qAbs(1 / direction.y()) : infinity;
+    qreal nextX = direction.x() != 0 ? (x + (stepX > 0) - pos.x()) / direction.x() : infinity;
+    qreal nextY = direction.y() != 0 ? (y + (stepY > 0) - pos.y()) / direction.y() : infinity;
+
+    while (x >= 0 && y >= 0 && x < m_width && y < m_height) {
+        const int cell = y * m_width + x;
+        int side;
+        qreal depth;
+        if (nextX < nextY) {
+            side = stepX > 0 ? PotentiallyVisibleSet::Right : PotentiallyVisibleSet::Left;
+            depth = nextX;
+            nextX += deltaX;
+            x += stepX;
+        } else {
+            side = stepY > 0 ? PotentiallyVisibleSet::Bottom : PotentiallyVisibleSet::Top;
+            depth = nextY;
+            nextY += deltaY;
+            y += stepY;
+        }
+
+        int index = m_edgeWalls.at(4 * cell + side);
+        if (index < 0 && x >= 0 && y >= 0 && x < m_width && y < m_height)
+            index = m_edgeWalls.at(4 * (y * m_width + x) + oppositeSide[side]);
+        if (index < 0)
+            continue;
+
+        // translucent walls have no image of their own
+        const WallItem *wall = m_walls.at(index);
+        if (wall->image().isNull())
+            continue;
+
+        // u runs from b to a, like the x axis of the item
+        const QPointF point = pos + direction * depth;
+        const QPointF along = wall->a() - wall->b();
+        const qreal length = qSqrt(along.x() * along.x() + along.y() * along.y());
+        qreal u = ((point.x() - wall->b().x()) * along.x() + (point.y() - wall->b().y()) * along.y()) / length;
+
+        // doors slide over to a and show less of their image as they go
+        if (wall->type() == -1) {
+            if (u < doorTime * length)
+                continue;
+            u -= doorTime * length;
+        }
+
+        hit->wall = index;
+        hit->depth = depth;
+        hit->u = u;
+        hit->pos = point;
+        return true;
+    }
+
+    return false;
+}
+
+void Raycaster::draw(QPainter *painter, const QRect &rect, const Camera &camera, const QVector<Light> &lights,
+                     const QVector<Entity *> &entities, qreal doorTime, const QImage &floorImage,
+                     const QImage &ceilingImage)
+{
+    const QRect target = rect & QRect(0, 0, painter->device()->width(), painter->device()->height());
+    if (target.isEmpty())
+        return;
+
+    // the rays are cast for a level camera and its image is moved to
+    // where the pitched camera has the horizon
+    Camera level = camera;
+    level.setPitch(0);
+    const QMatrix4x4 &m = level.viewProjectionMatrix();
+    const QTransform device = painter->transform();
+
+    Projection &p = m_projection;
+    p.pos = camera.pos();
+    const QPointF axis = camera.mapToCamera(camera.pos() + QPointF(1, 0));
+    p.right = QPointF(axis.x(), -axis.y());
+    p.forward = QPointF(axis.y(), axis.x());
+
+    p.left = toDevice(m, device, p.toScene(0, 1), 0).x();
+    p.scale = toDevice(m, device, p.toScene(1, 1), 0).x() - p.left;
+    if (qFuzzyIsNull(p.scale))
+        return;
+
+    // rows at depth d are horizon + k / d, two depths give both
+    const qreal floorNear = toDevice(m, device, p.toScene(0, 1), 0.5).y();
+    const qreal floorFar = toDevice(m, device, p.toScene(0, 2), 0.5).y();
+    p.floor = 2 * (floorNear - floorFar);
+    p.horizon = floorNear - p.floor;
+    p.ceiling = toDevice(m, device, p.toScene(0, 1), -0.5).y() - p.horizon;
+
+    const qreal pitchShift = device.map(QPointF(0, horizonShift(camera))).y() - device.map(QPointF(0, 0)).y();
+    p.horizon += pitchShift;
+
+    const int columns = target.width();
+    m_hits.resize(columns);
+    m_depths.fill(std::numeric_limits<qreal>::infinity(), columns);
+    for (int i = 0; i < columns; ++i) {
+        const qreal sx = (target.left() + i + 0.5 - p.left) / p.scale;
+        Hit &hit = m_hits[i];
+        if (castRay(p.forward + p.right * sx, doorTime, &hit))
+            m_depths[i] = hit.depth;
+        else
+            hit.wall = -1;
+    }
+
+    // runs of columns on the same wall, for the floor and for the widgets
+    // on walls
+    m_wallLines.clear();
+    m_wallColumns.clear();
+    for (int i = 0; i < columns;) {
+        int end = i + 1;
+        while (end < columns && m_hits.at(end).wall == m_hits.at(i).wall)
+            ++end;
+
+        if (m_hits.at(i).wall >= 0) {
+            m_wallLines << QLineF(m_hits.at(i).pos, m_hits.at(end - 1).pos);
+
+            WallItem *wall = m_walls.at(m_hits.at(i).wall);
+            if (wall->childItem())
+                m_wallColumns[wall] += QRect(target.left() + i, target.top(), end - i, target.height());
+        }
+        i = end;
+    }
+
+    QMatrix4x4 floorMatrix;
+    QMatrix4x4 ceilingMatrix;
+    planeMatrices(m, &floorMatrix, &ceilingMatrix);
+
+    const QTransform shifted = device * QTransform::fromTranslate(0, pitchShift);
+    m_floorCaster.draw(painter, target, floorMatrix.toTransform(0) * shifted, ceilingMatrix.toTransform(0) * shifted,
+                       m_wallLines, floorImage, ceilingImage);
+
+    if (m_buffer.width() < target.width() || m_buffer.height() < target.height()) {
+        m_buffer = QImage(qMax(m_buffer.width(), target.width()), qMax(m_buffer.height(), target.height()),
+                          QImage::Format_ARGB32_Premultiplied);
+    }
+    for (int y = 0; y < target.height(); ++y)
+        memset(m_buffer.scanLine(y), 0, target.width() * sizeof(QRgb));
+
+    drawWalls(target, lights);
+
+    m_spriteRegion = QRegion();
+    drawEntities(target, entities);
+    if (!m_spriteRegion.isEmpty()) {
+        QHash<QGraphicsItem *, QRegion>::iterator it;
+        for (it = m_wallColumns.begin(); it != m_wallColumns.end(); ++it)
+            *it -= m_spriteRegion;
+    }
+
+    painter->save();
+    painter->resetTransform();
+    painter->drawImage(target.topLeft(), m_buffer, QRect(QPoint(0, 0), target.size()));
+    painter->restore();
+}
+
+qreal Raycaster::horizonShift(const Camera &camera)
+{
+    Camera level = camera;
+    level.setPitch(0);
+
+    // a point far ahead is on the horizon
+    const QPointF axis = camera.mapToCamera(camera.pos() + QPointF(1, 0));
+    const QPointF far = camera.pos() + QPointF(axis.y(), axis.x()) * 100;
+    const QTransform identity;
+    return toDevice(camera.viewProjectionMatrix(), identity, far, 0).y()
+        - toDevice(level.viewProjectionMatrix(), identity, far, 0).y();
+}
+
+// the rows of rect that lie between top and bottom, end is exclusive
+static bool rowRange(const QRect &rect, qreal top, qreal bottom, int *first, int *end)
+{
+    const qreal low = rect.top() - 1;
+    const qreal high = rect.bottom() + 1;
+    *first = qMax(rect.top(), qCeil(qBound(low, top - 0.5, high)));
+    *end = qMin(rect.bottom() + 1, qCeil(qBound(low, bottom - 0.5, high)));
+    return *first < *end;
+}
+
+void Raycaster::drawWalls(const QRect &rect, const QVector<Light> &lights)
+{
+    const int stride = m_buffer.bytesPerLine() / sizeof(QRgb);
+    QRgb *bits = reinterpret_cast<QRgb *>(m_buffer.bits());
+
+    for (int i = 0; i < rect.width(); ++i) {
+        const Hit &hit = m_hits.at(i);
+        if (hit.wall < 0)
+            continue;
+
+        // baked walls have the lights in their image already and span the
+        // whole wall, the others repeat their texture once per unit
+        const WallItem *wall = m_walls.at(hit.wall);
+        const bool baked = !wall->litImage().isNull();
+        const QImage &image = baked ? wall->litImage() : wall->image();
+        if (image.depth() != 32)
+            continue;
+
+        const qreal top = m_projection.row(-0.5, hit.depth);
+        const qreal bottom = m_projection.row(0.5, hit.depth);
+        int first;
+        int end;
+        if (!rowRange(rect, top, bottom, &first, &end))
+            continue;
+
+        const QRect source = baked ? image.rect() : wall->sourceRect();
+        const qreal u = baked ? hit.u / wall->boundingRect().width() : hit.u - qFloor(hit.u);
+        const int texelStride = image.bytesPerLine() / sizeof(QRgb);
+        const int column = source.x() + qBound(0, int(u * source.width()), source.width() - 1);
+        const QRgb *texels = reinterpret_cast<const QRgb *>(image.constBits()) + source.y() * texelStride + column;
+
+        const qreal dv = source.height() / (bottom - top);
+        const int shade = baked ? 256 : 256 * (255 - shadowAlpha(lights, hit.pos)) / 255;
+        wallColumn(bits + (first - rect.top()) * stride + i, stride, end - first, (first + 0.5 - top) * dv, dv,
+                   texels, texelStride, source.height(), shade);
+    }
+}
+
+void Raycaster::drawEntities(const QRect &rect, const QVector<Entity *> &entities)
+{
+    const Projection &p = m_projection;
+
+    // far to near, so that nearer sprites cover the ones behind them
+    QVector<QPair<qreal, Entity *> > order;
+    foreach (Entity *entity, entities) {
+        if (entity->isObscured() || entity->image().isNull())
+            continue;
+
+        const QPointF d = entity->displayedPos() - p.pos;
+        const qreal depth = d.x() * p.forward.x() + d.y() * p.forward.y();
+        if (depth > nearDepth)
+            order << qMakePair(-depth, entity);
+    }
+    qSort(order);
+
+    for (int i = 0; i < order.size(); ++i)
+        drawSprite(rect, order.at(i).second);
+}
+
+// Draws the sprite of entity in the columns where it is nearer than the
+// wall, the sprite is the quad the item would be projected to.
+void Raycaster::drawSprite(const QRect &rect, Entity *entity)
+{
+    const Projection &p = m_projection;
+    const QImage &image = entity->image();
+    if (image.depth() != 32)
+        return;
+
+    const QRectF bounds = entity->boundingRect();
+    const QPointF center = (entity->a() + entity->b()) / 2;
+    const QPointF along = (entity->a() - entity->b()) / QLineF(entity->b(), entity->a()).length();
+
+    // the left and the right edge in camera space, and their texture u
+    QPointF ends[2];
+    qreal us[] = { 0, 1 };
+    for (int i = 0; i < 2; ++i) {
+        const QPointF d = center + along * (i ? bounds.right() : bounds.left()) - p.pos;
+        ends[i] = QPointF(d.x() * p.right.x() + d.y() * p.right.y(), d.x() * p.forward.x() + d.y() * p.forward.y());
+    }
+
+    if (ends[0].y() < nearDepth && ends[1].y() < nearDepth)
+        return;
+    for (int i = 0; i < 2; ++i) {
+        if (ends[i].y() >= nearDepth)
+            continue;
+        const QPointF other = ends[1 - i];
+        const qreal t = (nearDepth - other.y()) / (ends[i].y() - other.y());
+        ends[i] = other + (ends[i] - other) * t;
+        us[i] = us[1 - i] + (us[i] - us[1 - i]) * t;
+    }
+
+    const qreal x0 = p.left + p.scale * ends[0].x() / ends[0].y();
+    const qreal x1 = p.left + p.scale * ends[1].x() / ends[1].y();
+    const int firstColumn = qMax(rect.left(), qCeil(qMax(qMin(x0, x1), qreal(rect.left() - 1)) - 0.5));
+    const int lastColumn = qMin(rect.right(), qFloor(qMin(qMax(x0, x1), qreal(rect.right() + 1)) - 0.5));
+
+    const QRect source = entity->sourceRect();
+    const int texelStride = image.bytesPerLine() / sizeof(QRgb);
+    const QRgb *texels = reinterpret_cast<const QRgb *>(image.constBits()) + source.y() * texelStride + source.x();
+
+    const int stride = m_buffer.bytesPerLine() / sizeof(QRgb);
+    QRgb *bits = reinterpret_cast<QRgb *>(m_buffer.bits());
+    const QPointF d = ends[1] - ends[0];
+
+    // sprites facing the camera cover the same rows in every column, so
+    // the columns drawn are collected as runs
+    QRect covered;
+
+    for (int x = firstColumn; x <= lastColumn; ++x) {
+        // where the ray of the column meets the sprite
+        const qreal sx = (x + 0.5 - p.left) / p.scale;
+        const qreal denominator = d.x() - sx * d.y();
+        if (qFuzzyIsNull(denominator))
+            continue;
+        const qreal t = qBound(qreal(0), (sx * ends[0].y() - ends[0].x()) / denominator, qreal(1));
+        const qreal depth = ends[0].y() + t * d.y();
+        if (depth >= m_depths.at(x - rect.left()))
+            continue;
+
+        const qreal top = p.row(bounds.top(), depth);
+        const qreal bottom = p.row(bounds.bottom(), depth);
+        int first;
+        int end;
+        if (!rowRange(rect, top, bottom, &first, &end))
+            continue;
+
+        if (covered.isValid() && covered.right() + 1 == x && covered.top() == first && covered.bottom() + 1 == end) {
+            covered.setRight(x);
+        } else {
+            m_spriteRegion += covered;
+            covered = QRect(x, first, 1, end - first);
+        }
+
+        const qreal u = us[0] + t * (us[1] - us[0]);
+        const QRgb *column = texels + qBound(0, int(u * source.width()), source.width() - 1);
+        const qreal dv = source.height() / (bottom - top);
+        QRgb *pixel = bits + (first - rect.top()) * stride + x - rect.left();
+        for (int y = first; y < end; ++y, pixel += stride) {
+            const int row = qBound(0, int((y + 0.5 - top) * dv), source.height() - 1);
+            const QRgb texel = column[row * texelStride];
+            if (qAlpha(texel) == 255)
+                *pixel = texel;
+            else if (qAlpha(texel))
+                *pixel = blendPixel(texel, *pixel);
+        }
+    }
+    m_spriteRegion += covered;
+}
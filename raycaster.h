@@ -0,0 +1,119 @@
+#ifndef RAYCASTER_H
+#define RAYCASTER_H
+
+#include <QHash>
+#include <QImage>
+#include <QLineF>
+#include <QRect>
+#include <QRegion>
+#include <QSet>
+#include <QVector>
+
+#include "floorcaster.h"
+
+class Camera;
+class Entity;
+class Light;
+class QGraphicsItem;
+class QPainter;
+class WallItem;
+
+// Draws a grid map in software without any QGraphicsItem, for machines
+// without OpenGL where projecting every item through QPainter is slow. Each
+// screen column casts one ray that steps from cell edge to cell edge (DDA)
+// until it meets a wall, and the wall's texture column is stretched over
+// the rows it covers. The depth of each column then clips the entity
+// sprites, and FloorCaster fills the floor and the ceiling around the walls.
+//
+// Rays stay level, so the pitch of the camera is shown by moving the
+// horizon instead of tilting the walls.
+class Raycaster
+{
+public:
+    Raycaster();
+
+    // edgeWalls holds the index into walls of the wall on each side of each
+    // cell, in the order of PotentiallyVisibleSet::Side, or -1
+    void setMap(int width, int height, const QVector<int> &edgeWalls, const QVector<WallItem *> &walls);
+
+    // items besides the walls that draw() paints, the scene's entities
+    void addItem(QGraphicsItem *item);
+
+    // draws the part rect of the painter's device, doorTime is how far the
+    // doors have slid open, see ProjectedItem::setAnimationTime()
+    void draw(QPainter *painter, const QRect &rect, const Camera &camera, const QVector<Light> &lights,
+              const QVector<Entity *> &entities, qreal doorTime, const QImage &floorImage,
+              const QImage &ceilingImage);
+
+    // whether the raycaster draws item itself
+    bool drawsItem(QGraphicsItem *item) const { return m_items.contains(item); }
+
+    // device columns where wall was the nearest one in the last draw(),
+    // less where sprites covered it, for the widgets walls carry
+    QRegion wallColumns(QGraphicsItem *wall) const { return m_wallColumns.value(wall); }
+
+    // how far in scene coordinates the pitch of camera moves the horizon,
+    // the level image is shifted by it and so are the widgets on walls
+    static qreal horizonShift(const Camera &camera);
+
+private:
+    // maps camera space, where the camera looks along positive y, to the
+    // device
+    struct Projection
+    {
+        QPointF pos;
+        QPointF right;
+        QPointF forward;
+
+        // the device column of camera space x / y is left + scale * x / y
+        qreal left;
+        qreal scale;
+
+        // the device row of height y at depth d is
+        // horizon + (ceiling + (y + 0.5) * (floor - ceiling)) / d
+        qreal horizon;
+        qreal ceiling;
+        qreal floor;
+
+        QPointF toScene(qreal x, qreal y) const { return pos + right * x + forward * y; }
+        qreal row(qreal y, qreal depth) const { return horizon + (ceiling + (y + 0.5) * (floor - ceiling)) / depth; }
+    };
+
+    struct Hit
+    {
+        int wall;
+        qreal depth;
+        // from b along the wall, what a door slid away taken off
+        qreal u;
+        QPointF pos;
+    };
+
+    bool castRay(const QPointF &direction, qreal doorTime, Hit *hit) const;
+    void drawWalls(const QRect &rect, const QVector<Light> &lights);
+    void drawEntities(const QRect &rect, const QVector<Entity *> &entities);
+    void drawSprite(const QRect &rect, Entity *entity);
+
+    int m_width;
+    int m_height;
+    QVector<int> m_edgeWalls;
+    QVector<WallItem *> m_walls;
+    QSet<QGraphicsItem *> m_items;
+
+    Projection m_projection;
+
+    // the wall hit by the ray of each column of the last draw(), and its
+    // depth, infinite where the ray hit nothing
+    QVector<Hit> m_hits;
+    QVector<qreal> m_depths;
+
+    QVector<QLineF> m_wallLines;
+    QHash<QGraphicsItem *, QRegion> m_wallColumns;
+
+    // the device pixels sprites were drawn to in the last draw()
+    QRegion m_spriteRegion;
+
+    FloorCaster m_floorCaster;
+    QImage m_buffer;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "rectstore.h"
+
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// float has 24 bits of mantissa, the gap is 8 steps of it
+const float RectStore::gapBase = 1e-6f;
+const float RectStore::gapScale = 1.0f / (1 << 20);
+
+RectStore::RectStore()
+{
+}
+
+void RectStore::clear()
+{
+    m_left.clear();
+    m_top.clear();
+    m_right.clear();
+    m_bottom.clear();
+}
+
+void RectStore::resize(int size)
+{
+    m_left.resize(size);
+    m_top.resize(size);
+    m_right.resize(size);
+    m_bottom.resize(size);
+}
+
+void RectStore::append(const QRectF &rect)
+{
+    const QRectF r = rect.normalized();
+    m_left << r.left();
+    m_top << r.top();
+    m_right << r.right();
+    m_bottom << r.bottom();
+}
+
+void RectStore::set(int index, const QRectF &rect)
+{
+    const QRectF r = rect.normalized();
+    m_left[index] = r.left();
+    m_top[index] = r.top();
+    m_right[index] = r.right();
+    m_bottom[index] = r.bottom();
+}
+
+QRectF RectStore::rect(int index) const
+{
+    return QRectF(QPointF(m_left.at(index), m_top.at(index)),
+                  QPointF(m_right.at(index), m_bottom.at(index)));
+}
+
+// The rectangles are in float, so the box stops gap() short of them to
+// keep rounding from turning a contact into an overlap. Rectangles that
+// do not overlap the box across the direction of movement never block.
+qreal RectStore::sweep(const QRectF &box, Qt::Orientation orientation, qreal distance,
+                       int first, int last) const
+{
+    if (distance == 0 || first >= last)
+        return distance;
+
+    const bool horizontal = orientation == Qt::Horizontal;
+
+    const float *alongMin = horizontal ? m_left.constData() : m_top.constData();
+    const float *alongMax = horizontal ? m_right.constData() : m_bottom.constData();
+    const float *acrossMin = horizontal ? m_top.constData() : m_left.constData();
+    const float *acrossMax = horizontal ? m_bottom.constData() : m_right.constData();
+
+    const float boxMin = horizontal ? box.left() : box.top();
+    const float boxMax = horizontal ? box.right() : box.bottom();
+    const float boxAcrossMin = horizontal ? box.top() : box.left();
+    const float boxAcrossMax = horizontal ? box.bottom() : box.right();
+
+    const bool forward = distance > 0;
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    // nearest reachable contact, as a positive distance
+    float limit = infinity;
+    bool overlap = false;
+
+    int i = first;
+
+#if defined(__SSE2__)
+    const __m128 vBoxMin = _mm_set1_ps(boxMin);
+    const __m128 vBoxMax = _mm_set1_ps(boxMax);
+    const __m128 vAcrossMin = _mm_set1_ps(boxAcrossMin);
+    const __m128 vAcrossMax = _mm_set1_ps(boxAcrossMax);
+    const __m128 vGapBase = _mm_set1_ps(gapBase);
+    const __m128 vGapScale = _mm_set1_ps(gapScale);
+    const __m128 vSign = _mm_set1_ps(-0.0f);
+    const __m128 vInfinity = _mm_set1_ps(infinity);
+
+    __m128 vLimit = vInfinity;
+    __m128 vOverlap = _mm_setzero_ps();
+
+    for (; i + 4 <= last; i += 4) {
+        const __m128 minA = _mm_loadu_ps(alongMin + i);
+        const __m128 maxA = _mm_loadu_ps(alongMax + i);
+        const __m128 across = _mm_and_ps(_mm_cmplt_ps(vAcrossMin, _mm_loadu_ps(acrossMax + i)),
+                                         _mm_cmplt_ps(_mm_loadu_ps(acrossMin + i), vAcrossMax));
+
+        vOverlap = _mm_or_ps(vOverlap, _mm_and_ps(across, _mm_and_ps(_mm_cmplt_ps(vBoxMin, maxA),
+                                                                     _mm_cmplt_ps(minA, vBoxMax))));
+
+        __m128 ahead;
+        __m128 contact;
+        if (forward) {
+            const __m128 gap = _mm_add_ps(vGapBase, _mm_mul_ps(_mm_andnot_ps(vSign, minA), vGapScale));
+            ahead = _mm_and_ps(across, _mm_cmpge_ps(minA, vBoxMax));
+            contact = _mm_sub_ps(_mm_sub_ps(minA, vBoxMax), gap);
+        } else {
+            const __m128 gap = _mm_add_ps(vGapBase, _mm_mul_ps(_mm_andnot_ps(vSign, maxA), vGapScale));
+            ahead = _mm_and_ps(across, _mm_cmple_ps(maxA, vBoxMin));
+            contact = _mm_sub_ps(_mm_sub_ps(vBoxMin, maxA), gap);
+        }
+
+        contact = _mm_or_ps(_mm_and_ps(ahead, contact), _mm_andnot_ps(ahead, vInfinity));
+        vLimit = _mm_min_ps(vLimit, contact);
+    }
+
+    float limits[4];
+    _mm_storeu_ps(limits, vLimit);
+    limit = qMin(qMin(limits[0], limits[1]), qMin(limits[2], limits[3]));
+    overlap = _mm_movemask_ps(vOverlap) != 0;
+#endif
+
+    for (; i < last; ++i) {
+        if (!(boxAcrossMin < acrossMax[i] && acrossMin[i] < boxAcrossMax))
+            continue;
+
+        if (boxMin < alongMax[i] && alongMin[i] < boxMax)
+            overlap = true;
+        else if (forward && alongMin[i] >= boxMax)
+            limit = qMin(limit, alongMin[i] - boxMax - (gapBase + qAbs(alongMin[i]) * gapScale));
+        else if (!forward && alongMax[i] <= boxMin)
+            limit = qMin(limit, boxMin - alongMax[i] - (gapBase + qAbs(alongMax[i]) * gapScale));
+    }
+
+    if (overlap)
+        return 0;
+
+    const qreal reach = qMax(qreal(0), qreal(limit));
+    return forward ? qMin(distance, reach) : qMax(distance, -reach);
+}
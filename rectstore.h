@@ -0,0 +1,42 @@
+#ifndef RECTSTORE_H
+#define RECTSTORE_H
+
+#include <QRectF>
+#include <QVector>
+
+// Axis aligned rectangles kept as separate float arrays, like
+// SegmentStore, so that collision tests run four rectangles at a time.
+class RectStore
+{
+public:
+    RectStore();
+
+    void clear();
+    void resize(int size);
+    int size() const { return m_left.size(); }
+
+    void append(const QRectF &rect);
+    void set(int index, const QRectF &rect);
+    QRectF rect(int index) const;
+
+    // how far box can move along one axis, up to distance, before it
+    // touches one of the rectangles in [first, last), returns 0 if it
+    // overlaps one of them already
+    qreal sweep(const QRectF &box, Qt::Orientation orientation, qreal distance, int first, int last) const;
+
+    // how far a sweep stops short of an obstacle edge at coordinate, a few
+    // float steps there so that rounding does not turn the contact into an
+    // overlap, sweeps in qreal keep the same gap to give the same result
+    static qreal gap(qreal coordinate) { return gapBase + qAbs(coordinate) * gapScale; }
+
+    static const float gapBase;
+    static const float gapScale;
+
+private:
+    QVector<float> m_left;
+    QVector<float> m_top;
+    QVector<float> m_right;
+    QVector<float> m_bottom;
+};
+
+#endif
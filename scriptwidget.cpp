@@ -2,12 +2,29 @@
 #include "mazescene.h"
 #include "entity.h"
 
+#include <QScriptValueIterator>
+
 static QScriptValue qsRand(QScriptContext *, QScriptEngine *engine)
 {
     QScriptValue value(engine, qrand() / (RAND_MAX + 1.0));
     return value;
 }
 
+// the script's variables, a run that leaves them as they were gives the
+// same result the next time as long as nothing else changes
+static QStringList globals(QScriptEngine *engine)
+{
+    QStringList values;
+    QScriptValueIterator it(engine->globalObject());
+    while (it.hasNext()) {
+        it.next();
+        if (it.flags() & QScriptValue::SkipInEnumeration)
+            continue;
+        values << it.name() << it.value().toString();
+    }
+    return values;
+}
+
 void ScriptWidget::setPreset(int preset)
 {
     const char *presets[] =
@@ -28,6 +45,10 @@ void ScriptWidget::setPreset(int preset)
         "// player_y\n"
         "// time\n"
         "\n"
+        "// the script runs every 50 ms while it uses time or rand() or\n"
+        "// something in the world moves, otherwise once a second until\n"
+        "// a run leaves its variables as they were\n"
+        "\n"
         "entity.stop();\n",
         "entity.walk();\n"
         "if ((time % 20000) < 10000) {\n"
@@ -55,6 +76,9 @@ void ScriptWidget::setPreset(int preset)
 ScriptWidget::ScriptWidget(MazeScene *scene, Entity *entity)
     : m_scene(scene)
     , m_entity(entity)
+    , m_sinceEvaluation(0)
+    , m_usesTime(false)
+    , m_worldChanged(false)
 {
     new QVBoxLayout(this);
 
@@ -91,14 +115,51 @@ ScriptWidget::ScriptWidget(MazeScene *scene, Entity *entity)
     resize(300, 400);
     updateSource();
 
-    startTimer(50);
+    connect(m_scene, SIGNAL(worldChanged()), this, SLOT(worldChanged()));
+    connect(m_entity, SIGNAL(scriptReplayed(QString)), this, SLOT(replaySource(QString)));
     m_time.start();
+
+    m_slowTimer.setSingleShot(true);
+    m_slowTimer.setInterval(1000);
+    connect(&m_slowTimer, SIGNAL(timeout()), this, SLOT(slowTick()));
+}
+
+void ScriptWidget::worldChanged()
+{
+    m_worldChanged = true;
+    wake();
 }
 
-void ScriptWidget::timerEvent(QTimerEvent *)
+bool ScriptWidget::advanceFrame(int elapsed)
+{
+    m_sinceEvaluation += elapsed;
+    if (m_sinceEvaluation < 50)
+        return true;
+
+    m_sinceEvaluation = 0;
+    m_worldChanged = false;
+    const bool settled = evaluate();
+
+    // a script not using time or rand() gives the same result until
+    // something moves, unless it keeps changing its own variables
+    if (m_usesTime || m_worldChanged)
+        return true;
+    if (!settled)
+        m_slowTimer.start();
+    return false;
+}
+
+void ScriptWidget::slowTick()
+{
+    m_sinceEvaluation = 50;
+    wake();
+}
+
+// returns whether the run left the script's variables as they were
+bool ScriptWidget::evaluate()
 {
     QPointF player = m_scene->camera().pos();
-    QPointF entity = m_entity->pos();
+    QPointF entity = m_entity->displayedPos();
 
     QScriptValue px(m_engine, player.x());
     QScriptValue py(m_engine, player.y());
@@ -112,11 +173,19 @@ void ScriptWidget::timerEvent(QTimerEvent *)
     m_engine->globalObject().setProperty("my_y", ey);
     m_engine->globalObject().setProperty("time", time);
 
+    const QStringList before = globals(m_engine);
     m_engine->evaluate(m_source);
     if (m_engine->hasUncaughtException()) {
         QString text = m_engine->uncaughtException().toString();
         m_statusView->setText(text);
     }
+    return globals(m_engine) == before;
+}
+
+void ScriptWidget::replaySource(const QString &source)
+{
+    m_sourceEdit->setPlainText(source);
+    updateSource();
 }
 
 void ScriptWidget::display(QScriptValue value)
@@ -132,6 +201,18 @@ void ScriptWidget::updateSource()
 
     m_time.restart();
     m_source = m_sourceEdit->toPlainText();
+
+    QString code = m_source;
+    code.remove(QRegExp(QLatin1String("//[^\n]*")));
+    m_usesTime = code.contains(QRegExp(QLatin1String("\\b(time|rand)\\b")));
+    wake();
+
+    // only recorded, the commands of the script reach the simulation anyway
+    SimulationInput input(SimulationInput::Script);
+    input.entity = m_entity;
+    input.text = m_source;
+    m_scene->post(input);
+
     if (wasEvaluating)
         m_statusView->setText(QLatin1String("Aborted long running evaluation!"));
     else if (m_engine->canEvaluate(m_source))
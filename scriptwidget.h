@@ -4,10 +4,15 @@
 #include <QScriptEngine>
 #include <QtGui>
 
+#include "framescheduler.h"
+
 class MazeScene;
 class Entity;
 
-class ScriptWidget : public QWidget
+// Runs a script for an entity every 50 ms, as long as the script depends
+// on time or rand() or the world around it changes. Otherwise it runs once
+// a second until a run leaves the script's variables as they were.
+class ScriptWidget : public QWidget, public FrameClient
 {
     Q_OBJECT
 public:
@@ -19,9 +24,15 @@ public slots:
 private slots:
     void updateSource();
     void setPreset(int preset);
+    void replaySource(const QString &source);
+    void worldChanged();
+    void slowTick();
 
 protected:
-    void timerEvent(QTimerEvent *event);
+    bool advanceFrame(int elapsed);
+
+private:
+    bool evaluate();
 
 private:
     MazeScene *m_scene;
@@ -31,6 +42,11 @@ private:
     QLineEdit *m_statusView;
     QString m_source;
     QTime m_time;
+    QTimer m_slowTimer;
+
+    int m_sinceEvaluation;
+    bool m_usesTime;
+    bool m_worldChanged;
 };
 
 #endif
@@ -0,0 +1,145 @@
+#include "segmentstore.h"
+
+#include <qmath.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+SegmentStore::SegmentStore()
+{
+}
+
+void SegmentStore::clear()
+{
+    m_ax.clear();
+    m_ay.clear();
+    m_bx.clear();
+    m_by.clear();
+}
+
+void SegmentStore::resize(int size)
+{
+    m_ax.resize(size);
+    m_ay.resize(size);
+    m_bx.resize(size);
+    m_by.resize(size);
+}
+
+void SegmentStore::append(const QPointF &a, const QPointF &b)
+{
+    m_ax << a.x();
+    m_ay << a.y();
+    m_bx << b.x();
+    m_by << b.y();
+}
+
+void SegmentStore::set(int index, const QPointF &a, const QPointF &b)
+{
+    m_ax[index] = a.x();
+    m_ay[index] = a.y();
+    m_bx[index] = b.x();
+    m_by[index] = b.y();
+}
+
+void SegmentStore::mapToCamera(const QPointF &pos, qreal yaw, SegmentStore *result) const
+{
+    const float c = qCos(yaw * M_PI / 180);
+    const float s = qSin(yaw * M_PI / 180);
+    const float px = pos.x();
+    const float py = pos.y();
+
+    const int count = size();
+    result->resize(count);
+
+    const float *ax = m_ax.constData();
+    const float *ay = m_ay.constData();
+    const float *bx = m_bx.constData();
+    const float *by = m_by.constData();
+
+    float *cax = result->m_ax.data();
+    float *cay = result->m_ay.data();
+    float *cbx = result->m_bx.data();
+    float *cby = result->m_by.data();
+
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vc = _mm_set1_ps(c);
+    const __m128 vs = _mm_set1_ps(s);
+    const __m128 vpx = _mm_set1_ps(px);
+    const __m128 vpy = _mm_set1_ps(py);
+
+    for (; i + 4 <= count; i += 4) {
+        const __m128 dax = _mm_sub_ps(_mm_loadu_ps(ax + i), vpx);
+        const __m128 day = _mm_sub_ps(_mm_loadu_ps(ay + i), vpy);
+        const __m128 dbx = _mm_sub_ps(_mm_loadu_ps(bx + i), vpx);
+        const __m128 dby = _mm_sub_ps(_mm_loadu_ps(by + i), vpy);
+
+        _mm_storeu_ps(cax + i, _mm_sub_ps(_mm_mul_ps(vc, dax), _mm_mul_ps(vs, day)));
+        _mm_storeu_ps(cay + i, _mm_add_ps(_mm_mul_ps(vs, dax), _mm_mul_ps(vc, day)));
+        _mm_storeu_ps(cbx + i, _mm_sub_ps(_mm_mul_ps(vc, dbx), _mm_mul_ps(vs, dby)));
+        _mm_storeu_ps(cby + i, _mm_add_ps(_mm_mul_ps(vs, dbx), _mm_mul_ps(vc, dby)));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        const float dax = ax[i] - px;
+        const float day = ay[i] - py;
+        const float dbx = bx[i] - px;
+        const float dby = by[i] - py;
+
+        cax[i] = c * dax - s * day;
+        cay[i] = s * dax + c * day;
+        cbx[i] = c * dbx - s * dby;
+        cby[i] = s * dbx + c * dby;
+    }
+}
+
+// A segment is outside when both endpoints are behind the camera, or both
+// are beyond the same side plane of the wedge. This keeps a few segments
+// that only pass by a corner of the wedge, which is fine for culling.
+void SegmentStore::cullToWedge(qreal halfWidth, uchar *inside) const
+{
+    const float w = halfWidth;
+
+    const float *ax = m_ax.constData();
+    const float *ay = m_ay.constData();
+    const float *bx = m_bx.constData();
+    const float *by = m_by.constData();
+
+    const int count = size();
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vw = _mm_set1_ps(w);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (; i + 4 <= count; i += 4) {
+        const __m128 cax = _mm_loadu_ps(ax + i);
+        const __m128 cay = _mm_loadu_ps(ay + i);
+        const __m128 cbx = _mm_loadu_ps(bx + i);
+        const __m128 cby = _mm_loadu_ps(by + i);
+
+        const __m128 behind = _mm_and_ps(_mm_cmple_ps(cay, zero), _mm_cmple_ps(cby, zero));
+        const __m128 left = _mm_and_ps(_mm_cmplt_ps(_mm_add_ps(cax, _mm_mul_ps(vw, cay)), zero),
+                                       _mm_cmplt_ps(_mm_add_ps(cbx, _mm_mul_ps(vw, cby)), zero));
+        const __m128 right = _mm_and_ps(_mm_cmpgt_ps(_mm_sub_ps(cax, _mm_mul_ps(vw, cay)), zero),
+                                        _mm_cmpgt_ps(_mm_sub_ps(cbx, _mm_mul_ps(vw, cby)), zero));
+
+        const int outside = _mm_movemask_ps(_mm_or_ps(behind, _mm_or_ps(left, right)));
+        inside[i] = !(outside & 1);
+        inside[i + 1] = !(outside & 2);
+        inside[i + 2] = !(outside & 4);
+        inside[i + 3] = !(outside & 8);
+    }
+#endif
+
+    for (; i < count; ++i) {
+        const bool behind = ay[i] <= 0 && by[i] <= 0;
+        const bool left = ax[i] + w * ay[i] < 0 && bx[i] + w * by[i] < 0;
+        const bool right = ax[i] - w * ay[i] > 0 && bx[i] - w * by[i] > 0;
+
+        inside[i] = !(behind || left || right);
+    }
+}
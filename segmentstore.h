@@ -0,0 +1,40 @@
+#ifndef SEGMENTSTORE_H
+#define SEGMENTSTORE_H
+
+#include <QPointF>
+#include <QVector>
+
+// Segment endpoints kept as separate float arrays, so that per frame
+// passes over all segments run as tight, vectorizable loops.
+class SegmentStore
+{
+public:
+    SegmentStore();
+
+    void clear();
+    void resize(int size);
+    int size() const { return m_ax.size(); }
+
+    void append(const QPointF &a, const QPointF &b);
+    void set(int index, const QPointF &a, const QPointF &b);
+
+    QPointF a(int index) const { return QPointF(m_ax.at(index), m_ay.at(index)); }
+    QPointF b(int index) const { return QPointF(m_bx.at(index), m_by.at(index)); }
+
+    // stores all segments mapped into the space of a camera at pos looking
+    // along yaw in result, see Camera::mapToCamera()
+    void mapToCamera(const QPointF &pos, qreal yaw, SegmentStore *result) const;
+
+    // for segments in camera space, sets inside[i] to 0 for every segment
+    // that lies completely outside of the horizontal view wedge, halfWidth
+    // is the tangent of half the horizontal field of view
+    void cullToWedge(qreal halfWidth, uchar *inside) const;
+
+private:
+    QVector<float> m_ax;
+    QVector<float> m_ay;
+    QVector<float> m_bx;
+    QVector<float> m_by;
+};
+
+#endif
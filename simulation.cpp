@@ -0,0 +1,430 @@
+#include "simulation.h"
+
+#include <QEasingCurve>
+#include <QElapsedTimer>
+#include <QLineF>
+
+#include "entity.h"
+#include "inputrecording.h"
+
+// velocities are given per 5 ms
+static const int stepSize = 10;
+static const qreal velocityScale = stepSize / qreal(5);
+
+// after a stall the lost time is dropped instead of replayed, so one slow
+// step can not make the following ones slow
+static const int maxBacklog = 100;
+
+static const int doorDuration = 1000;
+
+static inline qreal interpolate(qreal a, qreal b, qreal t)
+{
+    return a + (b - a) * t;
+}
+
+Camera WorldSnapshot::cameraAt(qreal progress) const
+{
+    if (progress >= 1)
+        return camera;
+
+    Camera result = camera;
+    result.setPos(previousCamera.pos() + (camera.pos() - previousCamera.pos()) * progress);
+    result.setYaw(interpolate(previousCamera.yaw(), camera.yaw(), progress));
+    result.setPitch(interpolate(previousCamera.pitch(), camera.pitch(), progress));
+    result.setTime(interpolate(previousCamera.time(), camera.time(), progress));
+    return result;
+}
+
+EntityState WorldSnapshot::entityAt(int index, qreal progress) const
+{
+    const EntityState &current = entities.at(index);
+    if (progress >= 1 || index >= previousEntities.size())
+        return current;
+
+    const EntityState &previous = previousEntities.at(index);
+    EntityState result = current;
+    result.pos = previous.pos + (current.pos - previous.pos) * progress;
+    result.angle = interpolate(previous.angle, current.angle, progress);
+    return result;
+}
+
+Simulation::Simulation(MazeScene *scene, const Camera &camera)
+    : m_scene(scene)
+    , m_quit(0)
+    , m_stepTime(0)
+    , m_sleeping(0)
+    , m_posted(0)
+    , m_handled(0)
+    , m_inputHandled(false)
+    , m_recording(0)
+    , m_recordingStart(0)
+    , m_replay(0)
+    , m_replayed(0)
+    , m_replayStart(0)
+    , m_replaying(0)
+    , m_camera(camera)
+    , m_previousCamera(camera)
+    , m_walkingVelocity(0)
+    , m_strafingVelocity(0)
+    , m_turningSpeed(0)
+    , m_pitchSpeed(0)
+    , m_deltaYaw(0)
+    , m_deltaPitch(0)
+    , m_time(0)
+    , m_walkTime(0)
+    , m_doorTime(doorDuration)
+    , m_doorsOpening(false)
+    , m_doorsMoving(false)
+{
+    m_clock.start();
+}
+
+Simulation::~Simulation()
+{
+    stop();
+}
+
+void Simulation::stop()
+{
+    m_quit.fetchAndStoreOrdered(1);
+    if (m_sleeping.testAndSetOrdered(1, 0))
+        m_wake.release();
+    wait();
+    m_quit.fetchAndStoreOrdered(0);
+}
+
+void Simulation::post(const SimulationInput &input)
+{
+    // the replay is all the simulation gets
+    if (m_replaying)
+        return;
+
+    if (!isRunning()) {
+        ++m_posted;
+        ++m_handled;
+        handle(input);
+        publish();
+        return;
+    }
+
+    // the queue only fills up if the simulation thread hangs, in which
+    // case input is lost anyway
+    if (!m_input.push(input))
+        return;
+
+    ++m_posted;
+    if (m_sleeping.testAndSetOrdered(1, 0))
+        m_wake.release();
+}
+
+bool Simulation::isBusy() const
+{
+    const WorldSnapshot &latest = snapshot();
+    return latest.handledInputs != m_posted || latest.active;
+}
+
+qreal Simulation::progress() const
+{
+    const qint64 stepLength = qint64(stepSize) * 1000000;
+    const qint64 sinceStep = m_clock.nsecsElapsed() - snapshot().stepTime;
+    return qBound(qreal(0), qreal(sinceStep) / stepLength, qreal(1));
+}
+
+bool Simulation::updateSnapshot()
+{
+    return m_snapshots.update();
+}
+
+bool Simulation::arePassagesOpen() const
+{
+    return m_doorsOpening && !m_doorsMoving;
+}
+
+void Simulation::record(InputRecording *recording)
+{
+    m_recording = recording;
+    m_recordingStart = m_clock.nsecsElapsed();
+}
+
+void Simulation::replay(const InputRecording *recording)
+{
+    m_replay = recording;
+    m_replayed = 0;
+    m_replaying = !recording->events().isEmpty();
+}
+
+int Simulation::fastForward()
+{
+    if (!m_replay)
+        return 0;
+
+    int steps = 0;
+    while (m_replaying || (m_time < m_replay->length() && isActive())) {
+        replayInput(false);
+        if (!isActive())
+            continue;
+
+        advance();
+        ++steps;
+    }
+
+    publish();
+    return steps;
+}
+
+void Simulation::run()
+{
+    // in nanoseconds, like the clock
+    const qint64 stepLength = qint64(stepSize) * 1000000;
+    const qint64 maxLag = qint64(maxBacklog) * 1000000;
+    qint64 simulated = m_clock.nsecsElapsed();
+    m_replayStart = simulated;
+
+    while (!m_quit) {
+        SimulationInput input;
+        while (m_input.pop(&input)) {
+            ++m_handled;
+            handle(input);
+        }
+
+        if (m_replaying)
+            replayInput(true);
+
+        if (!isActive()) {
+            // the next recorded input is waited for in replayInput()
+            if (!m_replaying)
+                waitForInput();
+
+            // idle time is not simulated, the first step runs right away
+            simulated = m_clock.nsecsElapsed() - stepLength;
+            continue;
+        }
+
+        const qint64 now = m_clock.nsecsElapsed();
+        if (now - simulated > maxLag)
+            simulated = now - maxLag;
+
+        bool stepped = false;
+        while (simulated + stepLength <= now) {
+            advance();
+            simulated += stepLength;
+            stepped = true;
+        }
+
+        if (stepped) {
+            m_stepTime = simulated;
+            publish();
+        }
+
+        const qint64 wait = simulated + stepLength - m_clock.nsecsElapsed();
+        if (wait > 0)
+            usleep(wait / 1000);
+    }
+}
+
+// blocks until post() or stop() wakes the thread up
+void Simulation::waitForInput()
+{
+    m_sleeping.fetchAndStoreOrdered(1);
+
+    if (m_input.isEmpty() && !m_quit) {
+        m_wake.acquire();
+        return;
+    }
+
+    // input came in meanwhile, if a poster already reset m_sleeping its
+    // release has to be taken
+    if (!m_sleeping.testAndSetOrdered(1, 0))
+        m_wake.acquire();
+}
+
+// Handles the recorded input due before the next step. Input that came in
+// while nothing moved is due right away, since idle time is not simulated.
+// In real time the input also waits for the time it came in originally.
+void Simulation::replayInput(bool realTime)
+{
+    const QVector<InputRecording::Event> &events = m_replay->events();
+
+    while (m_replayed < events.size() && !m_quit) {
+        const InputRecording::Event &event = events.at(m_replayed);
+        if (event.time > m_time && isActive())
+            break;
+
+        if (realTime) {
+            const qint64 wait = event.wallTime * 1000000 - (m_clock.nsecsElapsed() - m_replayStart);
+            if (wait > 0) {
+                // in slices, so that stop() does not have to wait long
+                usleep(qMin(wait / 1000, qint64(10000)));
+                continue;
+            }
+        }
+
+        SimulationInput input = event.input;
+        input.entity = m_scene->entities().value(event.entity);
+        handle(input);
+        ++m_replayed;
+    }
+
+    if (m_replayed == events.size())
+        m_replaying = 0;
+}
+
+bool Simulation::isActive() const
+{
+    if (m_inputHandled || m_doorsMoving)
+        return true;
+
+    if (m_walkingVelocity != 0 || m_strafingVelocity != 0 || m_turningSpeed != 0 || m_pitchSpeed != 0
+        || m_deltaYaw != 0 || m_deltaPitch != 0)
+        return true;
+
+    foreach (Entity *entity, m_scene->entities()) {
+        if (entity->isActive())
+            return true;
+    }
+    return false;
+}
+
+void Simulation::handle(const SimulationInput &input)
+{
+    m_inputHandled = true;
+
+    if (m_recording) {
+        InputRecording::Event event;
+        event.time = m_time;
+        event.wallTime = (m_clock.nsecsElapsed() - m_recordingStart) / 1000000;
+        event.entity = m_scene->entities().indexOf(input.entity);
+        event.input = input;
+        event.input.entity = 0;
+        m_recording->append(event);
+    }
+
+    switch (input.type) {
+    case SimulationInput::Walk:
+        m_walkingVelocity = input.x;
+        break;
+    case SimulationInput::Strafe:
+        m_strafingVelocity = input.x;
+        break;
+    case SimulationInput::Turn:
+        m_turningSpeed = input.x;
+        break;
+    case SimulationInput::Pitch:
+        m_pitchSpeed = input.x;
+        break;
+    case SimulationInput::Look:
+        m_deltaYaw += input.x;
+        m_deltaPitch += input.y;
+        break;
+    case SimulationInput::ToggleDoors:
+        if (!m_doorsMoving) {
+            m_doorsOpening = !m_doorsOpening;
+            m_doorsMoving = true;
+        }
+        break;
+    case SimulationInput::SetDoorsOpen:
+        m_doorsOpening = input.x != 0;
+        m_doorsMoving = false;
+        m_doorTime = m_doorsOpening ? 0 : doorDuration;
+        break;
+    case SimulationInput::SetCamera:
+        m_camera.setPos(QPointF(input.x, input.y));
+        m_camera.setYaw(input.yaw);
+        m_camera.setPitch(input.pitch);
+
+        // a jump, not a move
+        m_previousCamera = m_camera;
+        break;
+    case SimulationInput::Script:
+        // the entity commands of the script are recorded as well, so the
+        // script is only shown again
+        if (m_replaying && input.entity)
+            input.entity->apply(input);
+        break;
+    default:
+        if (input.entity)
+            input.entity->apply(input);
+        break;
+    }
+}
+
+void Simulation::advance()
+{
+    const QVector<Entity *> &entities = m_scene->entities();
+    m_previousEntities.resize(entities.size());
+    for (int i = 0; i < entities.size(); ++i)
+        m_previousEntities[i] = entities.at(i)->state();
+    m_previousCamera = m_camera;
+
+    m_camera.setYaw(m_camera.yaw() + m_deltaYaw + m_turningSpeed * velocityScale);
+    m_camera.setPitch(m_camera.pitch() + m_deltaPitch + m_pitchSpeed * velocityScale);
+    m_deltaYaw = 0;
+    m_deltaPitch = 0;
+
+    bool walking = false;
+    if (m_walkingVelocity != 0) {
+        QPointF walkingDelta = QLineF::fromPolar(m_walkingVelocity * velocityScale, m_camera.yaw() - 90).p2();
+        QPointF pos = m_camera.pos();
+        if (m_scene->tryMove(pos, walkingDelta)) {
+            walking = true;
+            m_camera.setPos(pos);
+        }
+    }
+
+    if (m_strafingVelocity != 0) {
+        QPointF walkingDelta = QLineF::fromPolar(m_strafingVelocity * velocityScale, m_camera.yaw()).p2();
+        QPointF pos = m_camera.pos();
+        if (m_scene->tryMove(pos, walkingDelta)) {
+            walking = true;
+            m_camera.setPos(pos);
+        }
+    }
+
+    if (walking)
+        m_walkTime += stepSize;
+    m_camera.setTime(m_walkTime * 0.001);
+
+    m_scene->moveEntities(stepSize);
+
+    if (m_doorsMoving) {
+        m_doorTime += m_doorsOpening ? -stepSize : stepSize;
+        if (m_doorTime <= 0 || m_doorTime >= doorDuration) {
+            m_doorTime = qBound(0, m_doorTime, doorDuration);
+            m_doorsMoving = false;
+        }
+    }
+
+    m_time += stepSize;
+    m_inputHandled = false;
+}
+
+void Simulation::publish()
+{
+    WorldSnapshot &snapshot = m_snapshots.back();
+    snapshot.time = m_time;
+    snapshot.handledInputs = m_handled;
+    snapshot.active = isRunning() && (isActive() || m_replaying);
+    snapshot.stepTime = m_stepTime;
+    snapshot.camera = m_camera;
+
+    const QVector<Entity *> &entities = m_scene->entities();
+    snapshot.entities.resize(entities.size());
+    for (int i = 0; i < entities.size(); ++i)
+        snapshot.entities[i] = entities.at(i)->state();
+
+    // without the thread there are no steps to interpolate between
+    if (isRunning()) {
+        snapshot.previousCamera = m_previousCamera;
+        snapshot.previousEntities = m_previousEntities;
+    } else {
+        snapshot.previousCamera = m_camera;
+        snapshot.previousEntities = snapshot.entities;
+    }
+
+    // eases in and out like the QTimeLine the doors used to run on
+    static const QEasingCurve curve(QEasingCurve::InOutSine);
+    snapshot.doorValue = curve.valueForProgress(m_doorTime / qreal(doorDuration));
+    snapshot.doorsOpening = m_doorsOpening;
+
+    m_snapshots.publish();
+}
@@ -0,0 +1,234 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+#include "lockfree.h"
+#include "mazescene.h"
+
+class InputRecording;
+
+struct SimulationInput
+{
+    enum Type
+    {
+        // player controls, velocities are in x
+        Walk,
+        Strafe,
+        Turn,
+        Pitch,
+        // x and y are added to yaw and pitch once
+        Look,
+        ToggleDoors,
+        // opens the doors at once if x is not 0
+        SetDoorsOpen,
+        // moves the camera to (x, y) looking along yaw and pitch
+        SetCamera,
+        // entity commands, turn targets are in x and y
+        EntityWalk,
+        EntityStop,
+        EntityTurnLeft,
+        EntityTurnRight,
+        EntityTurnTowards,
+        // the script of the entity was changed to text, this only moves
+        // anything when played back
+        Script
+    };
+
+    SimulationInput(Type type = Walk, qreal x = 0, qreal y = 0)
+        : type(type)
+        , entity(0)
+        , x(x)
+        , y(y)
+        , yaw(0)
+        , pitch(0)
+    {
+    }
+
+    Type type;
+    Entity *entity;
+    qreal x;
+    qreal y;
+    qreal yaw;
+    qreal pitch;
+    QString text;
+};
+
+struct EntityState
+{
+    EntityState()
+        : angle(0)
+        , walked(false)
+    {
+    }
+
+    bool operator==(const EntityState &other) const
+    {
+        return pos == other.pos && angle == other.angle && walked == other.walked;
+    }
+    bool operator!=(const EntityState &other) const { return !(*this == other); }
+
+    QPointF pos;
+    qreal angle;
+    bool walked;
+};
+
+// Everything the scene needs to draw one step of the simulation. The
+// state before the step is kept as well, so that frames drawn between two
+// steps can interpolate.
+struct WorldSnapshot
+{
+    WorldSnapshot()
+        : time(0)
+        , stepTime(0)
+        , handledInputs(0)
+        , active(false)
+        , doorValue(1)
+        , doorsOpening(false)
+    {
+    }
+
+    // the states in between, progress 0 is the state before the step
+    Camera cameraAt(qreal progress) const;
+    EntityState entityAt(int index, qreal progress) const;
+
+    // simulated milliseconds
+    qint64 time;
+
+    // when the step was due, on the clock of the simulation in nanoseconds
+    qint64 stepTime;
+
+    // number of inputs taken into account, and whether the simulation
+    // keeps stepping after this snapshot, which it always does while a
+    // recording plays
+    int handledInputs;
+    bool active;
+
+    Camera camera;
+    Camera previousCamera;
+
+    // in the order of MazeScene::entities()
+    QVector<EntityState> entities;
+    QVector<EntityState> previousEntities;
+
+    // 1 for closed doors, 0 for open ones
+    qreal doorValue;
+    bool doorsOpening;
+};
+
+// Runs the camera, the entities and the doors of a scene in a thread of
+// its own, at a fixed time step. Input reaches it through a lock free
+// queue, and after every batch of steps it publishes a snapshot of the
+// world for the scene to draw. When nothing moves the thread sleeps until
+// the next input. Until start() is called input is handled right away on
+// the calling thread, so benchmarks can drive the scene without the
+// thread. Entities have to be added before starting.
+class Simulation : public QThread
+{
+public:
+    Simulation(MazeScene *scene, const Camera &camera);
+    ~Simulation();
+
+    // waits for the current step to finish
+    void stop();
+
+    // GUI thread
+    void post(const SimulationInput &input);
+    bool updateSnapshot();
+    const WorldSnapshot &snapshot() const { return m_snapshots.front(); }
+
+    // how far drawing should be from the previous to the current state of
+    // the snapshot, frames are drawn one step behind the simulation
+    qreal progress() const;
+
+    // whether snapshots are still to come, for input posted so far or
+    // because something is moving
+    bool isBusy() const;
+
+    // simulation thread, or any thread while it is not running
+    const Camera &camera() const { return m_camera; }
+    bool arePassagesOpen() const;
+    qint64 time() const { return m_time; }
+
+    // Appends all input handled from now on to recording, which has to
+    // outlive the simulation. Call before start().
+    void record(InputRecording *recording);
+
+    // Takes the input from recording instead of post() until it has all
+    // been handled, live input is dropped meanwhile. Once started, input
+    // is handled when it came in originally, but never at a different
+    // step. Call before start().
+    void replay(const InputRecording *recording);
+    bool isReplaying() const { return m_replaying; }
+
+    // instead of starting the thread, steps through the whole replay as
+    // fast as possible and returns the number of steps taken
+    int fastForward();
+
+protected:
+    void run();
+
+private:
+    void handle(const SimulationInput &input);
+    bool isActive() const;
+    void waitForInput();
+    void replayInput(bool realTime);
+    void advance();
+    void publish();
+
+    MazeScene *m_scene;
+
+    LockFreeQueue<SimulationInput, 1024> m_input;
+    TripleBuffer<WorldSnapshot> m_snapshots;
+    QAtomicInt m_quit;
+
+    // read on both threads, it is only started once
+    QElapsedTimer m_clock;
+    qint64 m_stepTime;
+
+    // the thread sets m_sleeping before waiting on m_wake, whoever resets
+    // it releases m_wake
+    QAtomicInt m_sleeping;
+    QSemaphore m_wake;
+
+    // inputs posted on the GUI thread and handled on the simulation thread
+    int m_posted;
+    int m_handled;
+    bool m_inputHandled;
+
+    InputRecording *m_recording;
+    qint64 m_recordingStart;
+
+    // m_replaying is read by post() on the GUI thread
+    const InputRecording *m_replay;
+    int m_replayed;
+    qint64 m_replayStart;
+    QAtomicInt m_replaying;
+
+    Camera m_camera;
+    Camera m_previousCamera;
+    QVector<EntityState> m_previousEntities;
+
+    qreal m_walkingVelocity;
+    qreal m_strafingVelocity;
+    qreal m_turningSpeed;
+    qreal m_pitchSpeed;
+
+    qreal m_deltaYaw;
+    qreal m_deltaPitch;
+
+    qint64 m_time;
+    qint64 m_walkTime;
+
+    // milliseconds into closing the doors
+    int m_doorTime;
+    bool m_doorsOpening;
+    bool m_doorsMoving;
+};
+
+#endif
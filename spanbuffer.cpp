@@ -0,0 +1,134 @@
+#include "spanbuffer.h"
+
+#include <limits>
+
+SpanBuffer::SpanBuffer()
+    : m_screenLeft(-std::numeric_limits<float>::infinity())
+    , m_screenRight(std::numeric_limits<float>::infinity())
+{
+    clear();
+}
+
+void SpanBuffer::clear()
+{
+    Span span;
+    span.item = 0;
+    span.index = -1;
+    span.sx1 = -std::numeric_limits<float>::infinity();
+    span.sx2 =  std::numeric_limits<float>::infinity();
+    span.w0 = 0;
+    span.dw = 0;
+    span.maxCy = std::numeric_limits<float>::infinity();
+
+    m_spans.clear();
+    m_spans.insert(span.sx1, span);
+
+    m_uncovered = double(m_screenRight) - double(m_screenLeft);
+}
+
+void SpanBuffer::setScreenRange(float left, float right)
+{
+    m_screenLeft = left;
+    m_screenRight = right;
+    clear();
+}
+
+bool SpanBuffer::isScreenCovered() const
+{
+    const double width = double(m_screenRight) - double(m_screenLeft);
+    return width < std::numeric_limits<double>::infinity() && m_uncovered <= 1e-5 * width;
+}
+
+// whether span is nearer than s between sx1 and sx2, walls do not cross,
+// so where they overlap one is nearer everywhere and the middle tells
+static inline bool isNearer(const Span &span, const Span &s, float sx1, float sx2)
+{
+    if (!s.item)
+        return true;
+
+    const float x = (sx1 + sx2) * 0.5f;
+    return span.w0 + span.dw * x > s.w0 + s.dw * x;
+}
+
+// makes sure a span starts at x and returns it
+SpanBuffer::Spans::iterator SpanBuffer::split(float x)
+{
+    Spans::iterator it = m_spans.upperBound(x);
+    --it;
+
+    Span &span = it.value();
+    if (span.sx1 == x)
+        return it;
+
+    Span split = span;
+    span.sx2 = x;
+    split.sx1 = x;
+    return m_spans.insert(x, split);
+}
+
+bool SpanBuffer::insert(const Span &span, bool checkOnly)
+{
+    if (!(span.sx1 < span.sx2))
+        return false;
+
+    if (checkOnly) {
+        Spans::const_iterator it = m_spans.upperBound(span.sx1);
+        --it;
+        for (; it != m_spans.constEnd() && it.key() < span.sx2; ++it) {
+            const Span &s = it.value();
+            if (isNearer(span, s, qMax(s.sx1, span.sx1), qMin(s.sx2, span.sx2)))
+                return true;
+        }
+        return false;
+    }
+
+    split(span.sx2);
+    Spans::iterator it = split(span.sx1);
+
+    bool visible = false;
+    Spans::iterator run = m_spans.end();
+    while (it != m_spans.end() && it.key() < span.sx2) {
+        Span &s = it.value();
+        if (!isNearer(span, s, s.sx1, s.sx2)) {
+            run = m_spans.end();
+            ++it;
+            continue;
+        }
+
+        visible = true;
+
+        if (!s.item) {
+            const float left = qMax(s.sx1, m_screenLeft);
+            const float right = qMin(s.sx2, m_screenRight);
+            if (left < right)
+                m_uncovered -= double(right) - double(left);
+        }
+
+        // merge consecutive replaced spans so the buffer stays small
+        if (run != m_spans.end()) {
+            run.value().sx2 = s.sx2;
+            it = m_spans.erase(it);
+            continue;
+        }
+
+        s.item = span.item;
+        s.index = span.index;
+        s.w0 = span.w0;
+        s.dw = span.dw;
+        s.maxCy = span.maxCy;
+        run = it;
+        ++it;
+    }
+    return visible;
+}
+
+bool SpanBuffer::isOccluded(float sx1, float sx2, float depth) const
+{
+    Spans::const_iterator it = m_spans.upperBound(sx1);
+    --it;
+    for (; it != m_spans.constEnd() && it.key() < sx2; ++it) {
+        if (!it.value().item || it.value().maxCy >= depth)
+            return false;
+    }
+    return true;
+}
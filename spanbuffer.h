@@ -0,0 +1,66 @@
+#ifndef SPANBUFFER_H
+#define SPANBUFFER_H
+
+#include <QMap>
+
+class ProjectedItem;
+
+struct Span
+{
+    ProjectedItem *item;
+
+    // identifies the segment of the item, or -1
+    int index;
+
+    // screen coordinates
+    float sx1;
+    float sx2;
+
+    // the inverse of the camera space depth is w0 + dw * sx along the span
+    float w0;
+    float dw;
+
+    // largest camera space depth
+    float maxCy;
+};
+
+// Ordered set of non-overlapping screen spans covering the whole
+// horizontal axis, keyed by their left edge. Finding the span under a
+// screen coordinate is a logarithmic lookup, so inserting a wall costs
+// O(log n) plus the number of spans it actually covers.
+class SpanBuffer
+{
+public:
+    typedef QMap<float, Span> Spans;
+
+    SpanBuffer();
+
+    void clear();
+
+    // the part of the axis that ends up on screen, used to tell when
+    // the screen is completely covered
+    void setScreenRange(float left, float right);
+    bool isScreenCovered() const;
+
+    // returns true if any part of the span is nearer than what is
+    // already in the buffer, if checkOnly is false those parts are
+    // replaced by the span
+    bool insert(const Span &span, bool checkOnly);
+
+    // returns true if everything between sx1 and sx2 is covered by spans
+    // that are nearer than depth at every point
+    bool isOccluded(float sx1, float sx2, float depth) const;
+
+    const Spans &spans() const { return m_spans; }
+
+private:
+    Spans::iterator split(float x);
+
+    Spans m_spans;
+
+    float m_screenLeft;
+    float m_screenRight;
+    double m_uncovered;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "tilerasterizer.h"
+
+#include <QGraphicsItem>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include <string.h>
+
+#include "mazescene.h"
+
+// more strips than threads, so that a thread that got the strips around
+// the horizon, where most walls are, is not left working alone
+static const int stripsPerThread = 2;
+
+// makes the part of image a strip with rect uses transparent
+static void clear(QImage *image, const QRect &rect)
+{
+    for (int y = 0; y < rect.height(); ++y)
+        memset(image->scanLine(y), 0, rect.width() * sizeof(QRgb));
+}
+
+// the part of the device the painter is clipped to
+static QRect deviceClipRect(QPainter *painter)
+{
+    const QRect device(0, 0, painter->device()->width(), painter->device()->height());
+    if (!painter->hasClipping())
+        return device;
+    return painter->worldTransform().mapRect(painter->clipRegion().boundingRect()) & device;
+}
+
+// casts the floor and the ceiling of one strip on a pool thread
+class TileRasterizer::FloorTask
+{
+public:
+    typedef void result_type;
+
+    FloorTask(const QTransform &floor, const QTransform &ceiling, const QVector<QLineF> &walls,
+              const QImage &floorImage, const QImage &ceilingImage)
+        : m_floor(floor)
+        , m_ceiling(ceiling)
+        , m_walls(walls)
+        , m_floorImage(floorImage)
+        , m_ceilingImage(ceilingImage)
+    {
+    }
+
+    void operator()(Strip &strip) const
+    {
+        if (strip.rect.isEmpty())
+            return;
+
+        clear(&strip.image, strip.rect);
+
+        // the strip's image starts at the top left of its rect
+        const QTransform offset = QTransform::fromTranslate(-strip.rect.left(), -strip.rect.top());
+        QPainter painter(&strip.image);
+        strip.floorCaster.draw(&painter, QRect(QPoint(0, 0), strip.rect.size()), m_floor * offset,
+                               m_ceiling * offset, m_walls, m_floorImage, m_ceilingImage);
+    }
+
+private:
+    QTransform m_floor;
+    QTransform m_ceiling;
+    QVector<QLineF> m_walls;
+    QImage m_floorImage;
+    QImage m_ceilingImage;
+};
+
+// paints the items that reach into one strip on a pool thread
+class TileRasterizer::ItemTask
+{
+public:
+    typedef void result_type;
+
+    ItemTask(QGraphicsItem **items, const QStyleOptionGraphicsItem *options, const QVector<QTransform> &transforms,
+             const QVector<QRect> &bounds, QPainter::RenderHints hints)
+        : m_items(items)
+        , m_options(options)
+        , m_transforms(transforms)
+        , m_bounds(bounds)
+        , m_hints(hints)
+    {
+    }
+
+    void operator()(Strip &strip) const
+    {
+        if (strip.rect.isEmpty())
+            return;
+
+        clear(&strip.image, strip.rect);
+
+        const QTransform offset = QTransform::fromTranslate(-strip.rect.left(), -strip.rect.top());
+        QPainter painter(&strip.image);
+        painter.setRenderHints(m_hints);
+        painter.setClipRect(QRect(QPoint(0, 0), strip.rect.size()));
+        for (int i = 0; i < m_transforms.size(); ++i) {
+            if (!m_bounds.at(i).intersects(strip.rect))
+                continue;
+            painter.setWorldTransform(m_transforms.at(i) * offset);
+            m_items[i]->paint(&painter, m_options + i, 0);
+        }
+    }
+
+private:
+    QGraphicsItem **m_items;
+    const QStyleOptionGraphicsItem *m_options;
+    QVector<QTransform> m_transforms;
+    QVector<QRect> m_bounds;
+    QPainter::RenderHints m_hints;
+};
+
+TileRasterizer::TileRasterizer()
+{
+    m_strips.resize(stripsPerThread * qMax(1, QThread::idealThreadCount()));
+}
+
+void TileRasterizer::addItem(ProjectedItem *item)
+{
+    m_items << item;
+}
+
+// cuts rect into rows of strips, strips left over are empty
+void TileRasterizer::split(const QRect &rect)
+{
+    const int count = m_strips.size();
+    const int height = (rect.height() + count - 1) / count;
+    for (int i = 0; i < count; ++i) {
+        Strip &strip = m_strips[i];
+        strip.rect = QRect(rect.left(), rect.top() + i * height, rect.width(), height) & rect;
+        if (strip.rect.isEmpty())
+            continue;
+
+        if (strip.image.width() < strip.rect.width() || strip.image.height() < strip.rect.height()) {
+            strip.image = QImage(qMax(strip.image.width(), strip.rect.width()),
+                                 qMax(strip.image.height(), strip.rect.height()),
+                                 QImage::Format_ARGB32_Premultiplied);
+        }
+    }
+}
+
+void TileRasterizer::composite(QPainter *painter)
+{
+    painter->save();
+    painter->resetTransform();
+    foreach (const Strip &strip, m_strips) {
+        if (!strip.rect.isEmpty())
+            painter->drawImage(strip.rect.topLeft(), strip.image, QRect(QPoint(0, 0), strip.rect.size()));
+    }
+    painter->restore();
+}
+
+void TileRasterizer::drawFloorAndCeiling(QPainter *painter, const QRect &rect, const QTransform &floor,
+                                         const QTransform &ceiling, const QVector<QLineF> &walls,
+                                         const QImage &floorImage, const QImage &ceilingImage)
+{
+    const QRect target = rect & QRect(0, 0, painter->device()->width(), painter->device()->height());
+    if (target.isEmpty())
+        return;
+
+    split(target);
+    QtConcurrent::blockingMap(m_strips, FloorTask(floor, ceiling, walls, floorImage, ceilingImage));
+    composite(painter);
+}
+
+void TileRasterizer::drawItems(QPainter *painter, int numItems, QGraphicsItem *items[],
+                               const QStyleOptionGraphicsItem options[])
+{
+    if (numItems == 0)
+        return;
+
+    const QRect clip = deviceClipRect(painter);
+    if (clip.isEmpty())
+        return;
+
+    // the transforms updateTransforms() left on the items, taken once here
+    // instead of by every strip
+    const QTransform viewTransform = painter->worldTransform();
+    QVector<QTransform> transforms(numItems);
+    QVector<QRect> bounds(numItems);
+    QRect covered;
+    for (int i = 0; i < numItems; ++i) {
+        transforms[i] = items[i]->deviceTransform(viewTransform);
+        bounds[i] = transforms.at(i).mapRect(items[i]->boundingRect()).toAlignedRect();
+        covered |= bounds.at(i);
+    }
+
+    // the view calls this once per run of items between widgets, each run
+    // only clears and copies back the part its own items reach
+    const QRect target = clip & covered;
+    if (target.isEmpty())
+        return;
+
+    split(target);
+    QtConcurrent::blockingMap(m_strips, ItemTask(items, options, transforms, bounds, painter->renderHints()));
+    composite(painter);
+}
@@ -0,0 +1,63 @@
+#ifndef TILERASTERIZER_H
+#define TILERASTERIZER_H
+
+#include <QImage>
+#include <QLineF>
+#include <QRect>
+#include <QSet>
+#include <QTransform>
+#include <QVector>
+
+#include "floorcaster.h"
+
+class ProjectedItem;
+class QGraphicsItem;
+class QPainter;
+class QStyleOptionGraphicsItem;
+
+// Paints the items of a view in software on all cores. The part of the
+// device to draw is cut into horizontal strips, a couple per pool thread,
+// and each strip paints the same items with its own QPainter into its own
+// image. The strips are then copied onto the view in order.
+//
+// Widgets can only be painted by the GUI thread, so only the items added
+// with addItem() go to the strips, the view paints everything else in
+// between as usual.
+class TileRasterizer
+{
+public:
+    TileRasterizer();
+
+    // lets the strips paint item
+    void addItem(ProjectedItem *item);
+    bool drawsItem(QGraphicsItem *item) const { return m_items.contains(item); }
+
+    // like FloorCaster::draw(), with a floor caster per strip
+    void drawFloorAndCeiling(QPainter *painter, const QRect &rect, const QTransform &floor, const QTransform &ceiling,
+                             const QVector<QLineF> &walls, const QImage &floorImage, const QImage &ceilingImage);
+
+    // paints items far to near into the part of the device the painter is
+    // clipped to, drawsItem() must be true for all of them
+    void drawItems(QPainter *painter, int numItems, QGraphicsItem *items[],
+                   const QStyleOptionGraphicsItem options[]);
+
+private:
+    struct Strip
+    {
+        // device rect, the image holds it from its top left corner on
+        QRect rect;
+        QImage image;
+        FloorCaster floorCaster;
+    };
+
+    class FloorTask;
+    class ItemTask;
+
+    void split(const QRect &rect);
+    void composite(QPainter *painter);
+
+    QSet<QGraphicsItem *> m_items;
+    QVector<Strip> m_strips;
+};
+
+#endif
@@ -0,0 +1,400 @@
+#include "worldrenderer.h"
+
+#include <QGLShaderProgram>
+#include <QPaintEngine>
+#include <QPainter>
+#include <QVector3D>
+
+#include <stddef.h>
+
+#include "mazescene.h"
+
+// texture units the shader picks wall images from, the walls of the asset
+// pack all share one
+static const int maxWallTextures = 4;
+
+static const char *vertexProgram =
+    "uniform mat4 matrix;\n"
+    "uniform float doorTime;\n"
+    "attribute vec3 position;\n"
+    "attribute vec2 texCoord;\n"
+    "attribute vec4 color;\n"
+    "attribute float textureIndex;\n"
+    "attribute vec4 source;\n"
+    "attribute vec4 door;\n"
+    "varying vec2 v_texCoord;\n"
+    "varying vec4 v_color;\n"
+    "varying float v_textureIndex;\n"
+    "varying vec4 v_source;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_Position = matrix * vec4(position + door.xyz * doorTime, 1.0);\n"
+    "    v_texCoord = vec2(texCoord.x - door.w * doorTime, texCoord.y);\n"
+    "    v_color = color;\n"
+    "    v_textureIndex = textureIndex;\n"
+    "    v_source = source;\n"
+    "}\n";
+
+// the color is premultiplied, like everything else QPainter blends, and
+// the image repeats within its part of the texture
+static const char *fragmentProgram =
+    "uniform sampler2D texture0;\n"
+    "uniform sampler2D texture1;\n"
+    "uniform sampler2D texture2;\n"
+    "uniform sampler2D texture3;\n"
+    "varying vec2 v_texCoord;\n"
+    "varying vec4 v_color;\n"
+    "varying float v_textureIndex;\n"
+    "varying vec4 v_source;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 texCoord = v_source.xy + fract(v_texCoord) * v_source.zw;\n"
+    "    vec4 texel = vec4(1.0);\n"
+    "    if (v_textureIndex > 2.5)\n"
+    "        texel = texture2D(texture3, texCoord);\n"
+    "    else if (v_textureIndex > 1.5)\n"
+    "        texel = texture2D(texture2, texCoord);\n"
+    "    else if (v_textureIndex > 0.5)\n"
+    "        texel = texture2D(texture1, texCoord);\n"
+    "    else if (v_textureIndex > -0.5)\n"
+    "        texel = texture2D(texture0, texCoord);\n"
+    "    gl_FragColor = texel * v_color;\n"
+    "}\n";
+
+enum
+{
+    PositionAttribute,
+    TexCoordAttribute,
+    ColorAttribute,
+    TextureAttribute,
+    SourceAttribute,
+    DoorAttribute
+};
+
+WorldRenderer::WorldRenderer()
+    : m_dirty(false)
+    , m_failed(false)
+    , m_program(0)
+    , m_floorQuad(-1)
+    , m_ceilingQuad(-1)
+    , m_floorTexture(0)
+    , m_ceilingTexture(0)
+{
+}
+
+WorldRenderer::~WorldRenderer()
+{
+    delete m_program;
+}
+
+bool WorldRenderer::isAvailable(QPainter *painter)
+{
+    if (m_failed || !painter->paintEngine() || painter->paintEngine()->type() != QPaintEngine::OpenGL2)
+        return false;
+
+    if (m_dirty) {
+        painter->beginNativePainting();
+        m_failed = !upload();
+        m_dirty = false;
+        painter->endNativePainting();
+    }
+
+    return !m_failed;
+}
+
+int WorldRenderer::wallIndex(QGraphicsItem *item) const
+{
+    return m_wallIndices.value(item, NotAWall);
+}
+
+static GLuint bindTexture(const QImage &image)
+{
+    // the context keeps the texture around for as long as the image lives
+    QGLContext *context = const_cast<QGLContext *>(QGLContext::currentContext());
+    const GLuint texture = context->bindTexture(image, GL_TEXTURE_2D, GL_RGBA,
+                                                QGLContext::LinearFilteringBindOption
+                                                | QGLContext::InvertedYBindOption);
+
+    // the floor and the ceiling repeat their image
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    return texture;
+}
+
+void WorldRenderer::addQuad(const Vertex *corners)
+{
+    for (int i = 0; i < 4; ++i)
+        m_vertices << corners[i];
+}
+
+// Long walls get one quad per scene unit, the lights fall off far from
+// linearly over their length, and each corner the shadow of the lights at
+// its position. Textures are flipped when bound, so v runs from
+// the bottom of the image up.
+void WorldRenderer::setWorld(const QVector<WallItem *> &walls, const QVector<Light> &lights,
+                             const QRectF &floor, const QImage &floorImage, const QImage &ceilingImage)
+{
+    m_vertices.clear();
+    m_firstQuad.fill(0, walls.size());
+    m_quadCount.fill(0, walls.size());
+    m_wallIndices.clear();
+    m_images.clear();
+
+    for (int i = 0; i < walls.size(); ++i) {
+        WallItem *wall = walls.at(i);
+        const QImage &image = wall->image();
+
+        int texture = -1;
+        if (!image.isNull()) {
+            for (int j = 0; j < m_images.size() && texture < 0; ++j) {
+                if (m_images.at(j).cacheKey() == image.cacheKey())
+                    texture = j;
+            }
+
+            if (texture < 0) {
+                // walls with more images than the shader takes paint themselves
+                if (m_images.size() == maxWallTextures)
+                    continue;
+
+                texture = m_images.size();
+                m_images << image;
+            }
+        }
+
+        QRectF source(0, 0, 1, 1);
+        if (texture >= 0) {
+            const QRect rect = wall->sourceRect();
+            source = QRectF(qreal(rect.x()) / image.width(), 1 - qreal(rect.y() + rect.height()) / image.height(),
+                            qreal(rect.width()) / image.width(), qreal(rect.height()) / image.height());
+        }
+
+        const QRectF bounds = wall->boundingRect();
+        const int quads = qMax(1, qRound(bounds.width()));
+        const bool door = wall->type() == -1;
+        const QMatrix4x4 &matrix = wall->modelMatrix();
+
+        m_firstQuad[i] = m_vertices.size() / 4;
+        m_quadCount[i] = quads;
+        m_wallIndices.insert(wall, i);
+
+        const QVector3D slide = matrix.map(QVector3D(bounds.right(), 0, 0))
+            - matrix.map(QVector3D(bounds.left(), 0, 0));
+
+        for (int quad = 0; quad < quads; ++quad) {
+            const qreal left = bounds.left() + bounds.width() * quad / quads;
+            const qreal right = bounds.left() + bounds.width() * (quad + 1) / quads;
+            const qreal xs[] = { left, right, right, left };
+            const qreal ys[] = { bounds.top(), bounds.top(), bounds.bottom(), bounds.bottom() };
+
+            Vertex corners[4];
+            for (int corner = 0; corner < 4; ++corner) {
+                Vertex &vertex = corners[corner];
+                const QVector3D pos = matrix.map(QVector3D(xs[corner], ys[corner], 0));
+                vertex.x = pos.x();
+                vertex.y = pos.y();
+                vertex.z = pos.z();
+
+                // merged walls repeat the image once per scene unit
+                vertex.u = xs[corner] - bounds.left();
+                if (bounds.width() <= 1)
+                    vertex.u /= bounds.width();
+                vertex.v = (bounds.bottom() - ys[corner]) / bounds.height();
+
+                const int shadow = wall->type() == 2 ? 100 : shadowAlpha(lights, QPointF(pos.x(), pos.z()));
+
+                // walls without an image only show their shadow
+                if (texture < 0) {
+                    vertex.r = vertex.g = vertex.b = 0;
+                    vertex.a = shadow / 255.0;
+                } else {
+                    vertex.r = vertex.g = vertex.b = 1 - shadow / 255.0;
+                    vertex.a = 1;
+                }
+                vertex.texture = texture;
+                vertex.su = source.x();
+                vertex.sv = source.y();
+                vertex.sw = source.width();
+                vertex.sh = source.height();
+
+                // doors slide their left edge over to the right one and
+                // show less of the image as they go
+                const bool leftEdge = xs[corner] == bounds.left();
+                vertex.dx = door && leftEdge ? slide.x() : 0;
+                vertex.dy = door && leftEdge ? slide.y() : 0;
+                vertex.dz = door && leftEdge ? slide.z() : 0;
+                vertex.du = door && !leftEdge ? vertex.u : 0;
+            }
+            addQuad(corners);
+        }
+    }
+
+    // the floor and the ceiling are drawn in their own plane
+    Vertex corners[4];
+    const QPointF points[] = { floor.topLeft(), floor.topRight(), floor.bottomRight(), floor.bottomLeft() };
+    for (int corner = 0; corner < 4; ++corner) {
+        Vertex &vertex = corners[corner];
+        vertex.x = points[corner].x();
+        vertex.y = points[corner].y();
+        vertex.z = 0;
+
+        // the image repeats every half scene unit
+        vertex.u = 2 * points[corner].x();
+        vertex.v = -2 * points[corner].y();
+        vertex.r = vertex.g = vertex.b = vertex.a = 1;
+        vertex.texture = 0;
+        vertex.su = vertex.sv = 0;
+        vertex.sw = vertex.sh = 1;
+        vertex.dx = vertex.dy = vertex.dz = vertex.du = 0;
+    }
+    m_floorQuad = m_vertices.size() / 4;
+    addQuad(corners);
+    m_ceilingQuad = m_vertices.size() / 4;
+    addQuad(corners);
+
+    m_floorImage = floorImage;
+    m_ceilingImage = ceilingImage;
+    m_dirty = true;
+}
+
+bool WorldRenderer::upload()
+{
+    if (!m_program) {
+        glewInit();
+
+        m_program = new QGLShaderProgram;
+        m_program->addShaderFromSourceCode(QGLShader::Vertex, vertexProgram);
+        m_program->addShaderFromSourceCode(QGLShader::Fragment, fragmentProgram);
+        m_program->bindAttributeLocation("position", PositionAttribute);
+        m_program->bindAttributeLocation("texCoord", TexCoordAttribute);
+        m_program->bindAttributeLocation("color", ColorAttribute);
+        m_program->bindAttributeLocation("textureIndex", TextureAttribute);
+        m_program->bindAttributeLocation("source", SourceAttribute);
+        m_program->bindAttributeLocation("door", DoorAttribute);
+        if (!m_program->link()) {
+            qWarning("WorldRenderer: %s", qPrintable(m_program->log()));
+            return false;
+        }
+    }
+
+    m_textures.clear();
+    foreach (const QImage &image, m_images)
+        m_textures << bindTexture(image);
+
+    // texture unit 0 holds these while the floor and the ceiling are drawn
+    m_floorTexture = bindTexture(m_floorImage);
+    m_ceilingTexture = bindTexture(m_ceilingImage);
+
+    if (!m_buffer.isCreated() && !m_buffer.create()) {
+        qWarning("WorldRenderer: could not create a vertex buffer");
+        return false;
+    }
+
+    m_buffer.bind();
+    m_buffer.setUsagePattern(QGLBuffer::StaticDraw);
+    m_buffer.allocate(m_vertices.constData(), m_vertices.size() * sizeof(Vertex));
+    m_buffer.release();
+    return true;
+}
+
+// maps scene coordinates through the painter into clip space
+static QMatrix4x4 clipMatrix(QPainter *painter)
+{
+    const qreal ortho[] = {
+        2.0 / painter->device()->width(), 0, 0, -1,
+        0, -2.0 / painter->device()->height(), 0, 1,
+        0, 0, -1, 0,
+        0, 0, 0, 1
+    };
+
+    return QMatrix4x4(ortho) * QMatrix4x4(painter->transform());
+}
+
+void WorldRenderer::begin(QPainter *painter, const QMatrix4x4 &matrix, qreal doorTime)
+{
+    painter->beginNativePainting();
+
+    // painter's algorithm, like the items
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    m_program->bind();
+    m_program->setUniformValue("matrix", clipMatrix(painter) * matrix);
+    m_program->setUniformValue("doorTime", GLfloat(doorTime));
+    m_program->setUniformValue("texture0", 0);
+    m_program->setUniformValue("texture1", 1);
+    m_program->setUniformValue("texture2", 2);
+    m_program->setUniformValue("texture3", 3);
+
+    m_buffer.bind();
+    const int stride = sizeof(Vertex);
+    m_program->setAttributeBuffer(PositionAttribute, GL_FLOAT, offsetof(Vertex, x), 3, stride);
+    m_program->setAttributeBuffer(TexCoordAttribute, GL_FLOAT, offsetof(Vertex, u), 2, stride);
+    m_program->setAttributeBuffer(ColorAttribute, GL_FLOAT, offsetof(Vertex, r), 4, stride);
+    m_program->setAttributeBuffer(TextureAttribute, GL_FLOAT, offsetof(Vertex, texture), 1, stride);
+    m_program->setAttributeBuffer(SourceAttribute, GL_FLOAT, offsetof(Vertex, su), 4, stride);
+    m_program->setAttributeBuffer(DoorAttribute, GL_FLOAT, offsetof(Vertex, dx), 4, stride);
+    for (int attribute = PositionAttribute; attribute <= DoorAttribute; ++attribute)
+        m_program->enableAttributeArray(attribute);
+}
+
+void WorldRenderer::end(QPainter *painter)
+{
+    for (int attribute = PositionAttribute; attribute <= DoorAttribute; ++attribute)
+        m_program->disableAttributeArray(attribute);
+    m_buffer.release();
+    m_program->release();
+
+    glActiveTexture(GL_TEXTURE0);
+    painter->endNativePainting();
+}
+
+static void appendQuads(QVector<GLuint> &indices, int firstQuad, int count)
+{
+    for (int quad = firstQuad; quad < firstQuad + count; ++quad) {
+        const GLuint base = 4 * quad;
+        indices << base << base + 1 << base + 2 << base << base + 2 << base + 3;
+    }
+}
+
+void WorldRenderer::drawFloorAndCeiling(QPainter *painter, const Camera &camera)
+{
+    QMatrix4x4 floorMatrix;
+    QMatrix4x4 ceilingMatrix;
+    planeMatrices(camera.viewProjectionMatrix(), &floorMatrix, &ceilingMatrix);
+
+    m_indices.clear();
+    appendQuads(m_indices, m_floorQuad, 1);
+
+    begin(painter, floorMatrix, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_floorTexture);
+    glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, m_indices.constData());
+
+    m_indices.clear();
+    appendQuads(m_indices, m_ceilingQuad, 1);
+
+    m_program->setUniformValue("matrix", clipMatrix(painter) * ceilingMatrix);
+    glBindTexture(GL_TEXTURE_2D, m_ceilingTexture);
+    glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, m_indices.constData());
+    end(painter);
+}
+
+void WorldRenderer::drawWalls(QPainter *painter, const Camera &camera, const QVector<int> &walls, qreal doorTime)
+{
+    m_indices.clear();
+    foreach (int wall, walls)
+        appendQuads(m_indices, m_firstQuad.at(wall), m_quadCount.at(wall));
+
+    if (m_indices.isEmpty())
+        return;
+
+    begin(painter, camera.viewProjectionMatrix(), doorTime);
+    for (int i = 0; i < m_textures.size(); ++i) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, m_textures.at(i));
+    }
+    glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, m_indices.constData());
+    end(painter);
+}
@@ -0,0 +1,98 @@
+#ifndef WORLDRENDERER_H
+#define WORLDRENDERER_H
+
+#include <GL/glew.h>
+#include <QGLBuffer>
+#include <QHash>
+#include <QImage>
+#include <QMatrix4x4>
+#include <QRectF>
+#include <QVector>
+
+class Camera;
+class Light;
+class QGLShaderProgram;
+class QGraphicsItem;
+class QPainter;
+class WallItem;
+
+// Draws the walls, the floor and the ceiling of a scene with OpenGL
+// instead of through one QGraphicsItem per wall. All quads go into one
+// vertex buffer when the renderer is first used, and lighting and the door
+// animation are vertex attributes, so a frame only hands over the order of
+// the visible walls. Only OpenGL viewports use it, sticking to what GL 2.1
+// offers so that software rasterizers like llvmpipe can run it.
+class WorldRenderer
+{
+public:
+    WorldRenderer();
+    ~WorldRenderer();
+
+    // what to draw, the vertices are uploaded again on the next frame
+    void setWorld(const QVector<WallItem *> &walls, const QVector<Light> &lights,
+                  const QRectF &floor, const QImage &floorImage, const QImage &ceilingImage);
+
+    // whether painter paints with OpenGL and the renderer could be set up
+    bool isAvailable(QPainter *painter);
+    bool hasFailed() const { return m_failed; }
+
+    // index of item in the walls given to setWorld(), or NotAWall
+    enum
+    {
+        NotAWall = -1
+    };
+    int wallIndex(QGraphicsItem *item) const;
+
+    void drawFloorAndCeiling(QPainter *painter, const Camera &camera);
+
+    // walls is in the order to draw in, doorTime is how far the doors have
+    // slid open, see ProjectedItem::setAnimationTime()
+    void drawWalls(QPainter *painter, const Camera &camera, const QVector<int> &walls, qreal doorTime);
+
+private:
+    struct Vertex
+    {
+        float x, y, z;
+        float u, v;
+        float r, g, b, a;
+        float texture;
+        // the part of the texture the image is in, for images in an atlas
+        float su, sv, sw, sh;
+        // how far the vertex and its texture coordinate move per unit of
+        // door time
+        float dx, dy, dz, du;
+    };
+
+    bool upload();
+    void addQuad(const Vertex *corners);
+    void begin(QPainter *painter, const QMatrix4x4 &matrix, qreal doorTime);
+    void end(QPainter *painter);
+
+    QImage m_floorImage;
+    QImage m_ceilingImage;
+    bool m_dirty;
+    bool m_failed;
+
+    QGLShaderProgram *m_program;
+    QGLBuffer m_buffer;
+    QVector<Vertex> m_vertices;
+
+    // first quad and number of quads of each wall
+    QVector<int> m_firstQuad;
+    QVector<int> m_quadCount;
+    int m_floorQuad;
+    int m_ceilingQuad;
+
+    QHash<QGraphicsItem *, int> m_wallIndices;
+
+    // wall images, at most one per texture unit of the shader
+    QVector<QImage> m_images;
+    QVector<GLuint> m_textures;
+    GLuint m_floorTexture;
+    GLuint m_ceilingTexture;
+
+    // scratch space for the indices of a frame
+    QVector<GLuint> m_indices;
+};
+
+#endif